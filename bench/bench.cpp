@@ -0,0 +1,245 @@
+// Benchmarks for the hot parts of the tracer, run with `make bench`.
+// Every benchmark traces some rays, reports rays/sec and ns/ray, and the peak RSS of the
+// process after it ran. --json PATH writes the same numbers for tracking regressions.
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+#include "manager.hpp"
+#include "objects.hpp"
+#include "sampler.hpp"
+#include "sphere_store.hpp"
+#include "utils.hpp"
+
+// Gets to the private tracing functions of the manager
+struct Benchmark {
+    static bool scene_intersect(const RayTracingManager& m, const Ray& ray, const Sphere*& sphere, Vector3& hit) { return m.scene_intersect(ray, sphere, hit); }
+    static Vector3 cast_ray(const RayTracingManager& m, const Ray& ray, const Sampler& sampler) { return m.trace_primary(ray, sampler); }
+    static T_PIXEL render_scene(const RayTracingManager& m) { return m.render_scene(); }
+    static int SSAA_factor(const RayTracingManager& m) { return static_cast<int>(m._SSAA_factor); }
+};
+
+namespace {
+    struct Result {
+        std::string name;
+        double rays;
+        double seconds;
+        long peak_rss_kb;
+    };
+
+    std::vector<Result> results;
+    bool quick = false;
+
+    long peak_rss_kb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Runs batch (which traces rays_per_batch rays) until at least min_seconds went by
+    void run(const std::string& name, const double& rays_per_batch, const std::function<void()>& batch, const double& min_seconds = 0.5) {
+        batch();    // Warm up
+
+        auto start = std::chrono::steady_clock::now();
+        double seconds = 0;
+        long batches = 0;
+        do {
+            batch();
+            batches++;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < (quick ? min_seconds / 5 : min_seconds));
+
+        Result result = { name, rays_per_batch * batches, seconds, peak_rss_kb() };
+        results.push_back(result);
+
+        std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(12) << result.rays / seconds / 1e6 << " Mrays/s"
+                  << std::setprecision(1) << std::setw(12) << seconds * 1e9 / result.rays << " ns/ray"
+                  << std::setw(10) << result.peak_rss_kb / 1024 << " MB peak\n";
+    }
+
+    // Deterministic numbers in [0, 1)
+    float random(const std::uint32_t& i) {
+        return Sampler::to_float(Sampler::hash(i * 0x9E3779B9u + 1));
+    }
+
+    // Spheres scattered in a box in front of the camera, sized so the box stays about equally full
+    std::vector<Sphere> make_spheres(const int& count) {
+        const _Material materials[2] = {
+            {.albedo = {0.6, 0.6, 0.5}, .ambient_reflection = 1, .diffuse_reflection = 0.55, .specular_reflection = 0.2, .specular_exponent = 50, .scattering_constant = 0},
+            {.albedo = {1, 1, 1}, .ambient_reflection = 1, .diffuse_reflection = 0.01, .specular_reflection = 10, .specular_exponent = 1425, .scattering_constant = 1},
+        };
+        const float radius = 6.0f / std::cbrt(static_cast<float>(count));
+
+        std::vector<Sphere> spheres;
+        spheres.reserve(count);
+        for (int i = 0; i < count; i++) {
+            Vector3 center = { 40 * random(3 * i) - 20, 40 * random(3 * i + 1) - 20, -10 - 20 * random(3 * i + 2) };
+            spheres.emplace_back(center, radius, materials[i % 8 == 0]);
+        }
+        return spheres;
+    }
+
+    std::vector<Light> make_lights(const int& count) {
+        std::vector<Light> lights;
+        for (int i = 0; i < count; i++)
+            lights.push_back({{ 80 * random(1000 + 3 * i) - 40, 20 + 30 * random(1001 + 3 * i), 20 * random(1002 + 3 * i) - 10 }, 1.5f / count, 1.5f / count});
+        return lights;
+    }
+
+    // Primary rays through a grid on the image plane
+    std::vector<Ray> make_rays(const int& count) {
+        std::vector<Ray> rays;
+        rays.reserve(count);
+        for (int i = 0; i < count; i++)
+            rays.push_back({ {0, 0, 0}, utils::normalize({ 1.6f * (2 * random(7 * i) - 1), 0.9f * (2 * random(7 * i + 1) - 1), -1 / 0.6f }) });
+        return rays;
+    }
+
+    RenderSettings quiet_settings() {
+        RenderSettings settings;
+        settings.headless = true;
+        return settings;
+    }
+
+    ////// BENCHMARKS //////
+    void bench_intersection() {
+        const std::vector<Sphere> spheres = make_spheres(64);
+        const std::vector<Ray> rays = make_rays(4096);
+
+        float t;
+        volatile int sink = 0;
+        run("intersect/sphere_scalar", rays.size() * spheres.size(), [&] {
+            int hits = 0;
+            for (auto& ray : rays)
+                for (auto& sphere : spheres) hits += sphere.intersect(ray, t);
+            sink = sink + hits;
+        });
+
+        // One ray against every sphere in a single kernel call
+        SphereStore store;
+        store.build(spheres);
+        run("intersect/kernel_" + store.kernel_name(), rays.size() * spheres.size(), [&] {
+            int hits = 0;
+            for (auto& ray : rays) {
+                float t_max = std::numeric_limits<float>::max();
+                hits += store.intersect(ray, 0, static_cast<int>(spheres.size()), t_max) >= 0;
+            }
+            sink = sink + hits;
+        });
+    }
+
+    void bench_scene_intersect() {
+        const std::vector<Ray> rays = make_rays(1 << 16);
+        const std::vector<Light> lights = make_lights(1);
+
+        for (int count : {10, 1000, 100000, 1000000}) {
+            if (quick && count > 100000) continue;
+
+            const std::vector<Sphere> spheres = make_spheres(count);
+            RayTracingManager manager(spheres, lights, {}, quiet_settings());
+
+            volatile int sink = 0;
+            run("scene_intersect/" + std::to_string(count), rays.size(), [&] {
+                const Sphere* sphere; Vector3 hit;
+                int hits = 0;
+                for (auto& ray : rays) hits += Benchmark::scene_intersect(manager, ray, sphere, hit);
+                sink = sink + hits;
+            });
+        }
+    }
+
+    void bench_shading() {
+        const std::vector<Sphere> spheres = make_spheres(1000);
+        const std::vector<Ray> rays = make_rays(1 << 14);
+
+        for (int count : {1, 8, 64}) {
+            const std::vector<Light> lights = make_lights(count);
+            RayTracingManager manager(spheres, lights, {}, quiet_settings());
+
+            volatile float sink = 0;
+            run("shading/" + std::to_string(count) + "_lights", rays.size(), [&] {
+                float sum = 0;
+                for (std::size_t i = 0; i < rays.size(); i++)
+                    sum += Benchmark::cast_ray(manager, rays[i], Sampler(0, i, 0, SamplerMode::LOW_DISCREPANCY)).x;
+                sink = sink + sum;
+            });
+        }
+    }
+
+    void bench_resolve() {
+        const int SSAA = 3, width = 1280 * SSAA, height = 720 * SSAA;
+        T_PIXEL pixels(width, height, FramebufferLayout::TILED);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) pixels.at(x, y) = {random(x), random(y), 0.5f};
+
+        // Counts samples, not rays
+        run("resolve/1280x720_ssaa3", static_cast<double>(width) * height, [&] {
+            T_COLOR colors = utils::adjust_pixels(pixels, SSAA);
+        }, 0.1);
+    }
+
+    void bench_frames() {
+        const std::vector<Sphere> spheres = make_spheres(1000);
+        const std::vector<Light> lights = make_lights(3);
+
+        for (int height : {90, 270, 720}) {
+            if (quick && height > 270) continue;
+
+            RenderSettings settings = quiet_settings();
+            settings.height = height;
+            settings.SSAA_factor = 2;
+            RayTracingManager manager(spheres, lights, {}, settings);
+
+            const int SSAA = Benchmark::SSAA_factor(manager);
+            const double samples = static_cast<double>(static_cast<int>(height * settings.ratio)) * height * SSAA * SSAA;
+            run("frame/" + std::to_string(height) + "p_ssaa2", samples, [&] {
+                T_COLOR colors = utils::adjust_pixels(Benchmark::render_scene(manager), SSAA);
+            }, 0.1);
+        }
+    }
+
+    void write_json(const std::string& path, const std::string& kernel) {
+        std::ofstream file(path);
+        file << "{\n  \"kernel\": \"" << kernel << "\",\n  \"threads\": " << TileScheduler().thread_count() << ",\n  \"results\": [\n";
+        for (std::size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            file << "    {\"name\": \"" << r.name << "\", \"rays\": " << std::fixed << std::setprecision(0) << r.rays
+                 << ", \"seconds\": " << std::setprecision(6) << r.seconds
+                 << ", \"rays_per_second\": " << std::setprecision(1) << r.rays / r.seconds
+                 << ", \"ns_per_ray\": " << std::setprecision(3) << r.seconds * 1e9 / r.rays
+                 << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        file << "  ]\n}\n";
+        std::cout << "Wrote " << path << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string json_path, filter;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) json_path = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if (arg == "--quick") quick = true;
+        else {
+            std::cout << "Usage: " << argv[0] << " [--json PATH] [--filter intersect|scene_intersect|shading|resolve|frame] [--quick]\n";
+            return arg == "-h" || arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    auto wanted = [&](const std::string& name) { return filter.empty() || filter == name; };
+    if (wanted("intersect"))       bench_intersection();
+    if (wanted("scene_intersect")) bench_scene_intersect();
+    if (wanted("shading"))         bench_shading();
+    if (wanted("resolve"))         bench_resolve();
+    if (wanted("frame"))           bench_frames();
+
+    if (!json_path.empty()) write_json(json_path, SphereStore().kernel_name());
+}
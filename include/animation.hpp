@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <raylib.h>
+#include <string>
+#include <vector>
+
+// Animations are a list of frames, every frame moves some spheres and lights of the scene
+// or changes materials (relative to the frame before it). Text, one command per line, # starts a comment:
+//   frame                                      Starts the next frame
+//   sphere <index> <x> <y> <z> [radius]        Moves sphere <index> (in scene order) to x y z
+//   light <index> <x> <y> <z>                  Moves light <index>
+//   material <index> [albedo r g b] ...        Changes the material of sphere <index>, same properties as
+//                                              the material lines of a scene, the others stay
+// The first frame is rendered completely, every frame after it only traces the tiles the moves
+// can reach (see render_animation), so a mostly static sequence costs a fraction of full frames.
+// With --set gbuffer=1 frames that dont move spheres dont even trace the primary rays (see gbuffer.hpp)
+namespace animation {
+    struct SphereMove {
+        std::size_t sphere;
+        Vector3 center;
+        float radius;                       // < 0 -> unchanged
+    };
+
+    struct LightMove {
+        std::size_t light;
+        Vector3 position;
+    };
+
+    struct MaterialChange {
+        std::size_t sphere;
+        std::string properties;             // The rest of the line, read_material applies it when the frame comes
+    };
+
+    struct Frame {
+        std::vector<SphereMove> spheres;
+        std::vector<LightMove> lights;
+        std::vector<MaterialChange> materials;
+    };
+
+    // Returns false (and prints why) when the file cant be read, is malformed or moves
+    // spheres / lights the scene doesnt have
+    [[nodiscard]] bool load(const std::string& path, const std::size_t& sphere_count, const std::size_t& light_count, std::vector<Frame>& frames);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <raylib.h>
+#include <vector>
+#include "utils.hpp"
+
+// Axis aligned bounding box
+struct AABB {
+    Vector3 min = { std::numeric_limits<float>::max(),     std::numeric_limits<float>::max(),     std::numeric_limits<float>::max()     };
+    Vector3 max = { std::numeric_limits<float>::lowest(),  std::numeric_limits<float>::lowest(),  std::numeric_limits<float>::lowest()  };
+
+    inline void grow(const Vector3& p) {
+        min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+        max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+    }
+
+    inline void grow(const AABB& b) { grow(b.min); grow(b.max); }
+
+    [[nodiscard]] inline bool empty() const { return min.x > max.x; }
+
+    [[nodiscard]] inline bool overlaps(const AABB& b) const {
+        return min.x <= b.max.x && b.min.x <= max.x
+            && min.y <= b.max.y && b.min.y <= max.y
+            && min.z <= b.max.z && b.min.z <= max.z;
+    }
+
+    [[nodiscard]] inline bool contains(const Vector3& p) const {
+        return min.x <= p.x && p.x <= max.x && min.y <= p.y && p.y <= max.y && min.z <= p.z && p.z <= max.z;
+    }
+
+    [[nodiscard]] inline Vector3 center() const { return 0.5f * (min + max); }
+
+    [[nodiscard]] inline float area() const {
+        if (empty()) return 0;
+        Vector3 d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // Slab test, https://tavianator.com/2011/ray_box.html
+    // Returns the entry distance, or infinity when the box is missed or further away than t_max
+    [[nodiscard]] inline float intersect(const Vector3& origin, const Vector3& inverse_direction, const float& t_max) const {
+        float tx1 = (min.x - origin.x) * inverse_direction.x, tx2 = (max.x - origin.x) * inverse_direction.x;
+        float ty1 = (min.y - origin.y) * inverse_direction.y, ty2 = (max.y - origin.y) * inverse_direction.y;
+        float tz1 = (min.z - origin.z) * inverse_direction.z, tz2 = (max.z - origin.z) * inverse_direction.z;
+
+        float t_enter = std::max({std::min(tx1, tx2), std::min(ty1, ty2), std::min(tz1, tz2), 0.0f});
+        float t_exit  = std::min({std::max(tx1, tx2), std::max(ty1, ty2), std::max(tz1, tz2), t_max});
+
+        return t_enter <= t_exit ? t_enter : std::numeric_limits<float>::infinity();
+    }
+};
+
+// 32 bytes, two nodes per cacheline.
+// Inner nodes: the left child is always the next node, first is the index of the right child.
+// Leaves: [first, first + count) in BVH::indices()
+struct BVHNode {
+    AABB bounds;
+    std::int32_t first;
+    std::int32_t count;     // 0 -> inner node
+
+    [[nodiscard]] inline bool leaf() const { return count != 0; }
+};
+
+// Bounding volume hierarchy over any primitives that have a bounding box.
+// Built top down with a binned SAH builder, stored as a flat depth first node array.
+// https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+class BVH {
+public:
+    static constexpr int MAX_DEPTH = 64;
+
+    void build(const std::vector<AABB>& primitive_bounds, const int& max_leaf_size = 4);
+
+    [[nodiscard]] inline bool empty() const { return _nodes.empty(); }
+    [[nodiscard]] inline const std::vector<BVHNode>& nodes() const { return _nodes; }
+    [[nodiscard]] inline const std::vector<int>& indices() const { return _indices; }
+
+    // Visits the leaves nearest child first, skipping every node further away than t_max.
+    // intersect_leaf(first, count, t_max) tests the primitives of a leaf and shrinks t_max
+    // when it finds a closer hit. Returning true stops the traversal (any hit queries).
+    // Returns how many nodes were visited
+    template <typename F>
+    inline int traverse(const Ray& ray, float& t_max, F&& intersect_leaf) const {
+        if (_nodes.empty()) return 0;
+
+        const Vector3 inverse_direction = { 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+        if (_nodes[0].bounds.intersect(ray.position, inverse_direction, t_max) == std::numeric_limits<float>::infinity()) return 1;
+
+        struct Entry { int node; float t; };
+        Entry stack[MAX_DEPTH];
+        int stack_size = 0;
+        stack[stack_size++] = {0, 0};
+        int visited = 0;
+
+        while (stack_size > 0) {
+            const Entry entry = stack[--stack_size];
+            if (entry.t > t_max) continue;  // Something closer was found after it was pushed
+
+            visited++;
+            const BVHNode& node = _nodes[entry.node];
+            if (node.leaf()) {
+                if (intersect_leaf(node.first, node.count, t_max)) return visited;
+                continue;
+            }
+
+            int near = entry.node + 1, far = node.first;
+            float t_near = _nodes[near].bounds.intersect(ray.position, inverse_direction, t_max);
+            float t_far  = _nodes[far].bounds.intersect(ray.position, inverse_direction, t_max);
+            if (t_far < t_near) { std::swap(near, far); std::swap(t_near, t_far); }
+
+            // Far goes first on the stack so near gets popped first
+            if (t_far  != std::numeric_limits<float>::infinity()) stack[stack_size++] = {far, t_far};
+            if (t_near != std::numeric_limits<float>::infinity()) stack[stack_size++] = {near, t_near};
+        }
+
+        return visited;
+    }
+
+    // Visits every leaf whose bounds contain point, visit_leaf(first, count)
+    template <typename F>
+    inline void query(const Vector3& point, F&& visit_leaf) const {
+        if (_nodes.empty() || !_nodes[0].bounds.contains(point)) return;
+
+        int stack[MAX_DEPTH];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const BVHNode& node = _nodes[stack[--stack_size]];
+            if (node.leaf()) {
+                visit_leaf(node.first, node.count);
+                continue;
+            }
+
+            const int left = static_cast<int>(&node - _nodes.data()) + 1, right = node.first;
+            if (_nodes[right].bounds.contains(point)) stack[stack_size++] = right;
+            if (_nodes[left].bounds.contains(point))  stack[stack_size++] = left;
+        }
+    }
+
+private:
+    std::vector<BVHNode> _nodes;
+    std::vector<int> _indices;
+};
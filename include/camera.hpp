@@ -6,11 +6,13 @@
 #include "utils.hpp"
 
 
+// The defaults are what the scene used before it could be loaded from a file.
+// Not const, a scene file (or the command line) fills it in after construction
 struct _Camera {
-    const Vector3 position;
-    const float focal_length;
-    const float fov;
-    const float render_distance;
-    const float scene_lighting;         // Basically the global lighting
-    const float max_reflection_depth;
+    Vector3 position = {0, 0, 0};
+    float focal_length = 0.6;
+    float fov = PI / 2;
+    float render_distance = 30;
+    float scene_lighting = 1;           // Basically the global lighting
+    float max_reflection_depth = 5;
 };
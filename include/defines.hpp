@@ -3,5 +3,5 @@
 #include <cstdint>
 
 
-#define T_PIXEL std::vector<std::vector<Vector3>>
-#define T_COLOR std::vector<Color>
+#define T_PIXEL Framebuffer<Vector3>
+#define T_COLOR Framebuffer<Color>
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <raylib.h>
+#include <vector>
+#include "defines.hpp"
+#include "framebuffer.hpp"
+#include "scheduler.hpp"
+
+// What the primary ray of one upsampled pixel hit, written next to its color when denoising.
+// The filter only averages samples that agree on all of it, so edges between objects,
+// creases and depth jumps stay sharp while the noise on a surface gets smoothed out
+struct DenoiseFeature {
+    Vector3 normal;                         // Missed -> 0
+    Vector3 albedo;
+    float depth;                            // Distance along the primary ray
+    int object;                             // See SurfaceHit::object, -1 -> missed
+    bool noisy;                             // Something random went into the sample, only those get filtered
+};
+
+using FeatureBuffer = Framebuffer<DenoiseFeature>;
+
+// Edge avoiding a trous wavelet filter, https://jo.dreggn.org/home/2010_atrous.pdf
+// Every pass is a 5x5 B3 spline kernel with its taps 2^pass pixels apart, so 5 passes reach as far
+// as a 125x125 kernel for 125 taps per pixel. Every tap is weighted down by how different its normal,
+// depth and albedo are (and dropped when its another object). How different the colors can be depends on
+// how noisy that part of the image is, like SVGF (https://research.nvidia.com/publication/2017-07_spatiotemporal-variance-guided-filtering-real-time-reconstruction-path-traced):
+// a variance estimated from the 7x7 neighbourhood first and filtered along with the color every pass.
+// Samples that arent noisy are left as they are, so shadows and mirror images stay as sharp as traced.
+// Runs on the upsampled pixels, before they get resolved, in bands of rows on the scheduler
+class Denoiser {
+public:
+    Denoiser(const int& passes, const float& strength);
+
+    // output can be pixels itself. The planes are kept, filtering a frame of the same size
+    // again (an animation) doesnt allocate
+    void filter(const T_PIXEL& pixels, const FeatureBuffer& features, T_PIXEL& output, TileScheduler& scheduler);
+
+    // Structure of arrays copy of the pixels and features, one float per pixel in each plane.
+    // Thats what lets the AVX2 row kernels do 8 pixels at once.
+    // Only the pixels the noisy ones can reach get copied in, mostly a small part of the image,
+    // the planes arent initialized so the pages of the rest never get touched
+    struct Planes {
+        using Plane = Framebuffer<float>;
+        int width = 0, height = 0;
+        Plane r[2], g[2], b[2];                 // Color, every pass reads one and writes the other
+        Plane variance[2];                      // Of the luminance, same
+        Plane nx, ny, nz;
+        Plane ax, ay, az;
+        Plane depth;
+        Plane inverse_depth2;                   // 1 / (depth * DEPTH_TOLERANCE)^2, 0 for misses
+        Plane object;                           // Exact up to 2^24 objects
+        Plane noisy;                            // 0 or 1
+        std::vector<int> span_x0, span_x1;      // Per row, the noisy pixels are in [x0, x1). Nothing else gets filtered
+        std::vector<int> reach_x0, reach_x1;    // Per row, what the spans read (taps, variance) is in [x0, x1). Nothing else is in the planes
+    };
+
+    // One row of one pass, from the planes source into the other ones. step 0 -> estimate the variance
+    using RowKernel = void (*)(Planes& planes, const int& source, const int& y, const int& step, const float& strength);
+
+private:
+    int _passes;
+    float _strength;
+    Planes _planes;
+    RowKernel _kernel;
+};
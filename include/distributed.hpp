@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+// One frame rendered by several processes, on one machine or across a cluster.
+// * The coordinator (--coordinate [HOST:]PORT) listens for workers, sends each of them the scene once
+//   and then hands out tiles of the resolved image, see RayTracingManager::render_distributed
+// * A worker (--worker HOST:PORT) traces and resolves every tile it gets with all its cores
+//   and sends the finished pixels back
+// --spawn N makes the coordinator start N local workers itself, which is all a single box needs.
+// Without a host the coordinator only takes workers from this machine (127.0.0.1), 0.0.0.0:PORT lets every one in.
+// Whoever connects gets the scene, there is no authentication
+//
+// Protocol: TCP, every message is a MessageHeader and size bytes of payload. Both ends have to be
+// the same build (the scene goes over in the binary scene format, which refuses other memory
+// layouts anyway), so everything is in native byte order.
+namespace distributed {
+    constexpr std::uint32_t PROTOCOL_VERSION = 1;
+
+    enum class MessageType : std::uint32_t {
+        HELLO,          // worker -> coordinator, payload: PROTOCOL_VERSION
+        SCENE,          // coordinator -> worker, payload: Scene::to_binary
+        TILE,           // coordinator -> worker, payload: the Tile
+        PIXELS,         // worker -> coordinator, payload: the Tile and its Colors, row major
+        DONE,           // coordinator -> worker, the worker exits
+
+        // The render server (see server.hpp) speaks the same protocol, clients say HELLO too
+        LOAD,           // client -> server, payload: Scene::to_binary
+        LOADED,         // server -> client, tile: the handle of the scene
+        RENDER,         // client -> server, tile: number of the job, payload: server::Job
+        IMAGE,          // server -> client, tile: number of the job, payload: the region (a Tile) and its Colors, row major
+        FAILED          // server -> client, tile: number of the job (or 0 for LOAD), payload: why
+    };
+
+    struct MessageHeader {
+        MessageType type;
+        std::uint32_t tile;                 // Index of the tile for TILE and PIXELS, see above for the others
+        std::uint64_t size;
+    };
+
+    // One end of a connection (TCP, or a local socket for the render server), closed when it goes away
+    class Connection {
+    public:
+        // timeout: seconds a send can wait for the other end to take the data, < 0 -> forever
+        Connection(const int& fd, const float& timeout);
+        ~Connection();
+
+        Connection(const Connection&) = delete;
+        Connection& operator = (const Connection&) = delete;
+
+        [[nodiscard]] inline int fd() const { return _fd; }
+
+        // false when the other end is gone (or doesnt take the data in time)
+        [[nodiscard]] bool send(const MessageType& type, const std::uint32_t& tile, const void* data = nullptr, const std::size_t& size = 0);
+
+        // Reads what has arrived, waits for something first if the socket is blocking.
+        // false when the other end is gone, or sends a message bigger than max_size (see too_big)
+        [[nodiscard]] bool receive();
+
+        // Messages with more payload than this are refused, nothing more of them gets read
+        inline void limit(const std::uint64_t& max_size) { _max_size = max_size; }
+        [[nodiscard]] bool too_big() const;
+
+        // Takes the next complete message out of what was received, false if there is none yet
+        [[nodiscard]] bool next(MessageHeader& header, std::string& payload);
+
+    private:
+        int _fd;
+        float _timeout;
+        std::uint64_t _max_size = std::numeric_limits<std::uint64_t>::max();
+        std::string _received;
+    };
+
+    // The listening end of the coordinator, plus the local workers it started
+    class Coordinator {
+    public:
+        explicit Coordinator(std::string scene) : _scene(std::move(scene)) {}
+        ~Coordinator();                     // Closes the socket, stops the spawned workers
+
+        Coordinator(const Coordinator&) = delete;
+        Coordinator& operator = (const Coordinator&) = delete;
+
+        // Listens on address ([host:]port, host 127.0.0.1 and port 0 -> any free one when left out) and starts
+        // spawn local workers, running executable (argv[0]). Returns false (and prints why) when it cant
+        [[nodiscard]] bool start(const std::string& address, const int& spawn, const std::string& executable);
+
+        // A worker that is waiting to connect, nullptr if there is none. Doesnt block
+        [[nodiscard]] std::unique_ptr<Connection> accept(const float& timeout);
+
+        [[nodiscard]] inline int fd() const { return _fd; }
+        [[nodiscard]] inline const std::string& scene() const { return _scene; }
+
+    private:
+        std::string _scene;
+        int _fd = -1;
+        std::vector<pid_t> _spawned;
+    };
+
+    // Connects to address, "host:port" or the path of a local socket (anything with a /).
+    // nullptr (and prints why) when it cant. The connection blocks
+    [[nodiscard]] std::unique_ptr<Connection> connect(const std::string& address, const float& timeout);
+
+    // Runs a worker until the coordinator at address ("host:port") is done or gone.
+    // settings get applied on top of the ones of the received scene (--threads, ...).
+    // Returns the exit code
+    [[nodiscard]] int work(const std::string& address, const std::vector<std::pair<std::string, std::string>>& settings);
+}
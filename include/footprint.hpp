@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <raylib.h>
+#include <vector>
+#include "bvh.hpp"
+#include "utils.hpp"
+
+// What the rays of one tile touched during a frame. An animation compares the next frame's
+// changes against it to find the tiles that have to be traced again (see render_animation).
+// * spheres:     every sphere a ray of the tile hit or got shadowed by. Moving one of them can change the tile
+// * reflections: bounds of every reflection ray segment. A sphere moving into them can show up in a mirror
+// * shadows:     per light, bounds of the origins of its shadow rays. Every segment runs from there to the light,
+//                so a sphere moving into the hull of the bounds and the light can cast a new shadow (may_shadow)
+// * lit:         some ray hit something, so moving any light changes the tile
+// Primary rays are covered by the screen space bounds of the moved spheres instead.
+struct TileFootprint {
+    std::vector<int> spheres;
+    AABB reflections;
+    std::vector<AABB> shadows;
+    bool lit = false;
+
+    inline void clear(const std::size_t& light_count) {
+        spheres.clear();
+        reflections = AABB();
+        shadows.assign(light_count, AABB());
+        lit = false;
+    }
+
+    // Sorted and without duplicates, for the lookups of the next frame
+    inline void finish() {
+        std::sort(spheres.begin(), spheres.end());
+        spheres.erase(std::unique(spheres.begin(), spheres.end()), spheres.end());
+    }
+
+    [[nodiscard]] inline bool touched(const int& sphere) const {
+        return std::binary_search(spheres.begin(), spheres.end(), sphere);
+    }
+
+    // Whether the sphere reaches into the hull of shadows[light] and light_position, so it can block a shadow ray.
+    // The hull is every box between shadows[light] (t = 0) and the light (t = 1), shrunk towards it.
+    // The distance of the center to those boxes is convex in t, so a ternary search finds its minimum
+    [[nodiscard]] inline bool may_shadow(const std::size_t& light, const Vector3& light_position, const Vector3& center, const float& radius) const {
+        const AABB& origins = shadows[light];
+        if (origins.empty()) return false;
+
+        auto distance2 = [&](const float& t) {
+            const Vector3 min = origins.min + t * (light_position - origins.min);
+            const Vector3 max = origins.max + t * (light_position - origins.max);
+            const Vector3 d = center - Vector3{ std::clamp(center.x, min.x, max.x), std::clamp(center.y, min.y, max.y), std::clamp(center.z, min.z, max.z) };
+            return d.x * d.x + d.y * d.y + d.z * d.z;
+        };
+
+        float t0 = 0, t1 = 1;
+        for (int i = 0; i < 32; i++) {
+            const float a = t0 + (t1 - t0) / 3, b = t1 - (t1 - t0) / 3;
+            if (distance2(a) < distance2(b)) t1 = b;
+            else t0 = a;
+        }
+        return std::min({distance2(0), distance2(t0), distance2(1)}) <= radius * radius;
+    }
+};
+
+// The tracing functions record into the footprint of the tile the calling thread is on.
+// Nothing gets recorded (one well predicted branch) when no footprint is bound, which is
+// every render except animations
+namespace footprint {
+    namespace detail {
+        inline thread_local TileFootprint* current = nullptr;
+    }
+
+    // Records into footprint until it goes out of scope
+    class Binding {
+    public:
+        explicit Binding(TileFootprint* footprint) { detail::current = footprint; }
+        ~Binding() { detail::current = nullptr; }
+        Binding(const Binding&) = delete;
+        Binding& operator = (const Binding&) = delete;
+    };
+
+    inline void touch(const int& sphere) {
+        TileFootprint* f = detail::current;
+        if (f && (f->spheres.empty() || f->spheres.back() != sphere)) f->spheres.push_back(sphere);
+    }
+
+    inline void hit() {
+        if (detail::current) detail::current->lit = true;
+    }
+
+    // A ray segment from -> to, the bounds of a segment are the bounds of its ends
+    inline void reflection(const Vector3& from, const Vector3& to) {
+        if (!detail::current) return;
+        detail::current->reflections.grow(from);
+        detail::current->reflections.grow(to);
+    }
+
+    // A shadow ray from origin to the light, the light itself is known
+    inline void shadow(const std::size_t& light, const Vector3& origin) {
+        if (detail::current) detail::current->shadows[light].grow(origin);
+    }
+}
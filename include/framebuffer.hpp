@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// How the pixels are laid out in memory.
+// ROW_MAJOR: the usual, y * width + x. Needed when handing the data to raylib or a file.
+// TILED:     the image is split into tile_size x tile_size blocks that each are contiguous,
+//            so a render tile (or a SSAA block) only touches a few cachelines / pages
+enum class FramebufferLayout {
+    ROW_MAJOR,
+    TILED
+};
+
+// One contiguous, preallocated image. Nothing gets allocated after the constructor
+// and the pixels are written directly with at(x, y).
+// The buffer is not initialized, every pixel is expected to be written before read.
+// It can also hold only a window of a bigger frame: at(x, y) still takes frame coordinates,
+// from (origin_x, origin_y) to (origin_x + width, origin_y + height)
+template <typename T>
+class Framebuffer {
+public:
+    Framebuffer() = default;
+    Framebuffer(const int& width, const int& height, const FramebufferLayout& layout = FramebufferLayout::ROW_MAJOR, const int& tile_size = 32,
+                const int& origin_x = 0, const int& origin_y = 0)
+        : _width(width), _height(height), _origin_x(origin_x), _origin_y(origin_y), _layout(layout) {
+        if (_layout == FramebufferLayout::TILED) {
+            // Round the tile up to a power of two so indexing is shifts and masks
+            while ((1 << _tile_shift) < tile_size) _tile_shift++;
+            _tile_mask = (1 << _tile_shift) - 1;
+            _tiles_x = (_width + _tile_mask) >> _tile_shift;
+            int tiles_y = (_height + _tile_mask) >> _tile_shift;
+            _size = static_cast<std::size_t>(_tiles_x * tiles_y) << (2 * _tile_shift);
+        } else {
+            _size = static_cast<std::size_t>(_width) * _height;
+        }
+
+        _data.reset(new T[_size]);
+    }
+
+    Framebuffer(Framebuffer&&) noexcept = default;
+    Framebuffer& operator = (Framebuffer&&) noexcept = default;
+
+    [[nodiscard]] inline T& at(const int& x, const int& y) { return _data[index(x, y)]; }
+    [[nodiscard]] inline const T& at(const int& x, const int& y) const { return _data[index(x, y)]; }
+
+    [[nodiscard]] inline int width()  const { return _width; }
+    [[nodiscard]] inline int height() const { return _height; }
+    [[nodiscard]] inline int origin_x() const { return _origin_x; }
+    [[nodiscard]] inline int origin_y() const { return _origin_y; }
+    [[nodiscard]] inline FramebufferLayout layout() const { return _layout; }
+
+    // Raw storage. Only in image order when the layout is ROW_MAJOR
+    [[nodiscard]] inline T* data() { return _data.get(); }
+    [[nodiscard]] inline const T* data() const { return _data.get(); }
+    [[nodiscard]] inline std::size_t size() const { return _size; }
+
+private:
+    [[nodiscard]] inline std::size_t index(int x, int y) const {
+        x -= _origin_x;
+        y -= _origin_y;
+        if (_layout == FramebufferLayout::ROW_MAJOR)
+            return static_cast<std::size_t>(y) * _width + x;
+
+        const std::size_t tile = static_cast<std::size_t>(y >> _tile_shift) * _tiles_x + (x >> _tile_shift);
+        return (tile << (2 * _tile_shift)) + ((y & _tile_mask) << _tile_shift) + (x & _tile_mask);
+    }
+
+private:
+    int _width = 0;
+    int _height = 0;
+    int _origin_x = 0;
+    int _origin_y = 0;
+    FramebufferLayout _layout = FramebufferLayout::ROW_MAJOR;
+
+    int _tile_shift = 0;
+    int _tile_mask = 0;
+    int _tiles_x = 0;
+
+    std::size_t _size = 0;
+    std::unique_ptr<T[]> _data;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <raylib.h>
+#include "framebuffer.hpp"
+
+// First hit of one upsampled pixel's primary ray. Normal and viewing direction are two
+// normalizes away from point, so they get recomputed instead of taking 24 more bytes
+struct GSample {
+    Vector3 point;                          // Missed (sphere < 0) -> unused, the sky comes from the ray
+    int sphere;                             // Index in the scene, -1 -> missed
+};
+
+// The first hits of a whole frame, same layout as its pixels.
+// As long as the spheres dont move the primary rays hit exactly the same points, so frames that
+// only move lights or change materials shade from here instead of intersecting the primary rays
+// again (see RayTracingManager::shade_tile). Shadows and reflections still get traced
+using GBuffer = Framebuffer<GSample>;
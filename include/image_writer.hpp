@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "defines.hpp"
+#include "framebuffer.hpp"
+#include "settings.hpp"
+
+// Writes images straight from the CPU pixel buffer, no window or GL context needed.
+// The format comes from the extension:
+// * .ppm  binary P6, no dependencies
+// * .png  encoded by raylib on the CPU (ExportImage)
+// * .exr  uncompressed scanline OpenEXR with 32 bit float channels
+namespace image {
+    // Returns false (and prints why) when the file couldnt be written
+    [[nodiscard]] bool write(const T_COLOR& colors, const std::string& path);
+
+    // Writes an image a band of rows at a time, top to bottom, for images that dont fit in memory.
+    // Only the band being written is ever held. PPM and EXR are the same files write makes,
+    // PNG is stored (uncompressed) deflate since ExportImage needs the whole image
+    class StreamWriter {
+    public:
+        StreamWriter() = default;
+        StreamWriter(const StreamWriter&) = delete;
+        StreamWriter& operator = (const StreamWriter&) = delete;
+
+        // Returns false (and prints why) for unknown formats or when the file cant be made
+        [[nodiscard]] bool open(const std::string& path, const int& width, const int& height);
+
+        // The next band.height() rows, band has to be as wide as the image
+        [[nodiscard]] bool write(const T_COLOR& band);
+
+        // Finishes the file, false if that fails or not every row was written
+        [[nodiscard]] bool close();
+
+    private:
+        enum class Format { PPM, PNG, EXR };
+
+        void png_chunk(const char type[4], const std::string& data);
+
+    private:
+        std::ofstream _file;
+        std::string _path;
+        Format _format = Format::PPM;
+        int _width = 0;
+        int _height = 0;
+        int _rows = 0;                      // Written so far
+        std::uint32_t _adler = 1;           // Adler-32 of the PNG image data so far
+    };
+
+    // Writes the frames of a sequence on a thread of its own, so the renderer traces the next frame
+    // while the last one gets encoded and written. The images are reused, never reallocated:
+    // queue_size of them can wait for (or be in) the writer and one more is the renderers to resolve
+    // into, with queue_size 1 thats double buffering. A full queue makes acquire wait.
+    // queue_size 0 -> no thread, submit writes before it returns
+    class SequenceWriter {
+    public:
+        explicit SequenceWriter(const int& queue_size);
+        ~SequenceWriter();
+        SequenceWriter(const SequenceWriter&) = delete;
+        SequenceWriter& operator = (const SequenceWriter&) = delete;
+
+        // An image nothing is reading, the renderer fills it and hands it to submit
+        [[nodiscard]] T_COLOR& acquire();
+        void submit(T_COLOR& image, const std::string& path);
+
+        // Waits until everything submitted is written. false if any of it couldnt be
+        [[nodiscard]] bool finish();
+
+        [[nodiscard]] bool failed();
+        [[nodiscard]] inline double encode_seconds() const { return _encode_seconds; }     // Only after finish
+        [[nodiscard]] inline double wait_seconds() const { return _wait_seconds; }         // The renderer in acquire
+
+    private:
+        void run();
+
+    private:
+        std::vector<T_COLOR> _images;
+        std::deque<int> _free;
+        std::deque<std::pair<int, std::string>> _queued;
+
+        std::mutex _mutex;
+        std::condition_variable _changed;
+        std::thread _thread;
+        bool _stop = false;
+        bool _failed = false;
+        double _encode_seconds = 0;
+        double _wait_seconds = 0;
+    };
+
+    // Applies the overwrite policy to path. Returns false when path exists and the policy is REFUSE.
+    // With UNIQUE an existing "name.png" becomes "name_1.png", "name_2.png", ...
+    [[nodiscard]] bool resolve_path(const std::string& path, const OverwritePolicy& policy, std::string& resolved);
+
+    [[nodiscard]] std::string extension(const std::string& path);
+
+    // Path of one frame of a sequence, "out.png" -> "out_0007.png"
+    [[nodiscard]] std::string frame_path(const std::string& path, const int& frame);
+}
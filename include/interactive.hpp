@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+// Interactive mode (--interactive). The camera moves with the keyboard and the window shows what it sees
+// within a frame time budget, instead of one finished image minutes later.
+// * While the view changes, every frame traces one sample per traced pixel at a scale (displayed pixels
+//   per traced pixel, per side) picked so it fits the budget. Coarse, but it follows the camera
+// * Once it stands still the samples pile up at full resolution: every frame adds one to as many tiles as
+//   fit the budget and uploads the mean, until every pixel has SSAA^2 of them like the offline render.
+//   Tiles the current pass hasnt reached yet keep what they showed
+namespace interactive {
+    constexpr double TRACING_SHARE = 0.8;   // Of a frame, the rest is input, upload and drawing
+    constexpr int MAX_SCALE = 16;
+
+    // Learns how long a traced pixel takes (all threads together) and turns the budget into pixels
+    class FrameBudget {
+    public:
+        explicit FrameBudget(const float& target_fps);
+
+        void record(const std::size_t& pixels, const double& seconds);
+
+        // Traced pixels that fit in the tracing share of a frame
+        [[nodiscard]] std::size_t pixels() const;
+
+        // Smallest scale that traces a width x height view within a frame
+        [[nodiscard]] int scale(const int& width, const int& height) const;
+
+    private:
+        double _seconds;                        // Tracing share of a frame
+        double _seconds_per_pixel = 1e-6;       // Until the first frame says otherwise
+    };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <vector>
+#include "bvh.hpp"
+#include "objects.hpp"
+
+// Finds the lights that can reach a point, for scenes with many of them.
+// Lights without a range reach everything and are always in. The ranged ones are in a BVH over
+// their spheres of influence, so a hit only looks at the few that are close, not at all of them.
+// See RayTracingManager::add_many_lights for how they get shaded (and sampled)
+class LightCuller {
+public:
+    void build(std::span<const Light> lights);
+
+    // false -> no light has a range, every light reaches everything
+    [[nodiscard]] inline bool ranged() const { return !_ranged.empty(); }
+
+    // Calls visit(l) for every light l that reaches point
+    template <typename F>
+    inline void gather(const Vector3& point, F&& visit) const {
+        for (const int& l : _global) visit(l);
+
+        _bvh.query(point, [&](const int& first, const int& count) {
+            for (int i = first; i < first + count; i++) {
+                const int l = _ranged[_bvh.indices()[i]];
+                if (utils::length(_lights[l].position - point) < _lights[l].range) visit(l);
+            }
+        });
+    }
+
+    // How much of a light is left at distance, smooth and 0 at the range
+    // https://cdn2.unrealengine.com/Resources/files/2013SiggraphPresentationsNotes-26915738.pdf (eq 9, without the inverse square)
+    [[nodiscard]] static inline float falloff(const Light& light, const float& distance) {
+        if (light.range <= 0) return 1;
+        const float x = distance / light.range;
+        const float window = std::clamp(1 - x * x * x * x, 0.0f, 1.0f);
+        return window * window;
+    }
+
+private:
+    std::span<const Light> _lights;
+    std::vector<int> _global;               // Lights without a range
+    std::vector<int> _ranged;               // Lights with one, in the order of the BVH primitives
+    BVH _bvh;
+};
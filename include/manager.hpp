@@ -1,37 +1,144 @@
 #pragma once
 
 #include <optional>
+#include <span>
+#include <string>
 #include <vector>
+#include "animation.hpp"
 #include "objects.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
+#include "denoiser.hpp"
+#include "distributed.hpp"
+#include "footprint.hpp"
+#include "gbuffer.hpp"
+#include "interactive.hpp"
+#include "light_culler.hpp"
+#include "mesh.hpp"
+#include "sampler.hpp"
+#include "scheduler.hpp"
+#include "settings.hpp"
+#include "shading.hpp"
+#include "sphere_store.hpp"
+#include "stats.hpp"
+#include "wavefront.hpp"
 
 class RayTracingManager {
 public:
-    RayTracingManager(const std::vector<Sphere>& spheres, const std::vector<Light>& lights);
+    RayTracingManager(std::span<const Sphere> spheres, std::span<const Light> lights, const _Camera& camera = {}, const RenderSettings& settings = {},
+                      const MeshView& meshes = {}, TileScheduler* scheduler = nullptr);   // nullptr -> a pool of its own
     ~RayTracingManager();
-    void render();
+
+    // With a coordinator the tiles get traced by its workers instead, see distributed.hpp
+    void render(distributed::Coordinator* coordinator = nullptr);
+
+    // Traces and resolves one tile of the displayed image, what a distributed worker does with a tile
+    [[nodiscard]] T_COLOR render_region(const Tile& tile) const;
+
+    // Renders frames first to last (inclusive) of an animation to output_path, see animation.hpp.
+    // The frames before first only get applied, not traced
+    void render_animation(const std::vector<animation::Frame>& frames, std::span<Sphere> spheres, std::span<Light> lights,
+                          const std::size_t& first, const std::size_t& last);
+
+    // Points the camera and sets the resolution (like the settings of the same names) of the next render_region,
+    // everything built from the scene stays. What the render server does between jobs, see server.hpp
+    void set_view(const _Camera& camera, const int& height, const float& ratio, const float& pixel_spacing, const int& SSAA);
+
+    // Opens the window and lets the camera move, see interactive.hpp. P writes what it shows to output_path
+    void render_interactive();
 
 private:
-    [[nodiscard]] T_PIXEL         render_scene() const;
-    [[nodiscard]] RenderTexture2D form_texture(const T_COLOR pixels, int w, int h) const;
-    [[nodiscard]] Vector3         cast_ray(const Ray& ray, const int& reflection_depth) const;
+    friend struct Benchmark;                 // bench/bench.cpp times the private tracing functions
+
+    [[nodiscard]] T_PIXEL         render_scene(FeatureBuffer* features = nullptr) const;
+    [[nodiscard]] T_COLOR         render_adaptive() const;
+    [[nodiscard]] T_COLOR         render_distributed(distributed::Coordinator& coordinator) const;
+    void                          render_streaming(const std::string& path) const;
+    [[nodiscard]] T_PIXEL         trace_region(const Tile& tile) const;
+    // gbuffer -> the first hits come from there, except for the tiles flagged in record_gbuffer (see shade_tile).
+    // features -> what the denoiser needs of every sample gets written there too
+    void                          trace_tiles(const std::vector<Tile>& tiles, T_PIXEL& pixels, const std::vector<TileFootprint*>& footprints = {}, const bool& show_progress = true,
+                                              GBuffer* gbuffer = nullptr, const std::vector<bool>& record_gbuffer = {}, FeatureBuffer* features = nullptr) const;
+    void                          shade_tile(const Tile& tile, T_PIXEL& pixels, GBuffer& gbuffer, const bool& record, const float& tan_half_fov, FeatureBuffer* features) const;
+    void                          feature_tile(const Tile& tile, T_PIXEL& pixels, FeatureBuffer& features, const float& tan_half_fov) const;
+    void                          trace_wavefront(const Tile& tile, wavefront::Buffers& buffers, T_PIXEL& pixels, const float& tan_half_fov) const;
+    [[nodiscard]] bool            move_camera(const float& seconds);
+    void                          trace_preview(const Tile& tile, T_COLOR& preview, const int& scale, const float& tan_half_fov) const;
+    void                          trace_refinement(const Tile& tile, T_PIXEL& sums, T_COLOR& display, const int& pass, const float& tan_half_fov) const;
+    [[nodiscard]] Texture2D       form_texture(const T_COLOR& pixels) const;
+    // path -> how the color gets into the pixel, see shading::Path
+    [[nodiscard]] Vector3         cast_ray(const Ray& ray, const int& reflection_depth, const Sampler& sampler, const shading::Path& path) const;
+    [[nodiscard]] Vector3         cast_primary(const Ray& ray, const Sampler& sampler, const shading::Path& path) const;
+    [[nodiscard]] Vector3         shade_hit(const SurfaceHit& surface, const int& reflection_depth, const Sampler& sampler, const shading::Path& path) const;
+    [[nodiscard]] Vector3         shade_primary(const SurfaceHit& surface, const Sampler& sampler, const shading::Path& path) const;
     [[nodiscard]] bool            scene_intersect(const Ray& ray, const Sphere*& h_sphere, Vector3& hit) const;
-                  void            check_image(const std::string PATH) const;
+    [[nodiscard]] bool            closest_hit(const Ray& ray, SurfaceHit& surface) const;
+    [[nodiscard]] bool            scene_occluded(const Ray& ray, const float& max_distance, int& last_occluder) const;
+    void                          report_stats() const;
+    void                          build_acceleration();
+    void                          build_lights();
+    void                          add_many_lights(const _Material& material, const Vector3& hit, const Vector3& hit_normal, const Vector3& viewing_direction,
+                                                  const int& reflection_depth, const Sampler& sampler, float& diffuse_lighting_intensity, float& specular_lighting_intensity) const;
+    [[nodiscard]] Tile            screen_bounds(const AABB& bounds, const int& width, const int& height) const;
 
-private:
-    const std::vector<Light>& _lights;
-    const std::vector<Sphere>& _spheres;
+    ////// KERNELS //////
+    // cast_ray, shade_hit and the render_scene tile loop, specialised at compile time for the common configurations.
+    // select_kernels picks them once the scene is known, anything uncommon gets the generic ones
+    using RayKernel  = Vector3 (RayTracingManager::*)(const Ray& ray, const Sampler& sampler, const shading::Path& path) const;
+    using ShadeKernel = Vector3 (RayTracingManager::*)(const SurfaceHit& surface, const Sampler& sampler, const shading::Path& path) const;
+    using TileKernel = void (RayTracingManager::*)(const Tile& tile, T_PIXEL& pixels, const float& tan_half_fov) const;
 
-    float _pixel_spacing = 1;                // Basically resolution of image
-    float _SSAA_factor = 5;                  // How much to upsample original image. more -> more time and better image
-    const float _displayed_ratio = 16.0 / 9.0;
-    const int   _displayed_height = 1000;
-    const int   _displayed_width  = _displayed_height * _displayed_ratio;
-    const float _upsampled_width  = _SSAA_factor * _displayed_width / _pixel_spacing;
-    const float _upsampled_height = _SSAA_factor * _displayed_height / _pixel_spacing;
+    // Recursion unrolled up to MAX_DEPTH. LIGHTS 0 -> any number of lights. !REFLECTIVE -> no reflection code at all
+    template <int MAX_DEPTH, int LIGHTS, bool REFLECTIVE, int DEPTH = 0>
+    [[nodiscard]] Vector3         trace(const Ray& ray, const Sampler& sampler, const shading::Path& path) const;
+    template <int MAX_DEPTH, int LIGHTS, bool REFLECTIVE, int DEPTH = 0>
+    [[nodiscard]] Vector3         shade(const SurfaceHit& surface, const Sampler& sampler, const shading::Path& path) const;
 
-    const std::string _FILE_PATH = "imgs/25aa.png";
-    const bool _write_file = false;
+    // SSAA 0 -> any SSAA factor
+    template <int SSAA>
+    void                          trace_tile(const Tile& tile, T_PIXEL& pixels, const float& tan_half_fov) const;
+
+    void                          select_kernels();
+
+    // The kernels for one sample, with what roulette corrected on it (see shading::with_reflection)
+    [[nodiscard]] inline Vector3  trace_primary(const Ray& ray, const Sampler& sampler) const {
+        Vector3 correction = {0, 0, 0};
+        const Vector3 color = (this->*_ray_kernel)(ray, sampler, shading::Path(correction));
+        return color + correction;
+    }
+    [[nodiscard]] inline Vector3  shade_first_hit(const SurfaceHit& surface, const Sampler& sampler) const {
+        Vector3 correction = {0, 0, 0};
+        const Vector3 color = (this->*_shade_kernel)(surface, sampler, shading::Path(correction));
+        return color + correction;
+    }
+
+private:
+    const std::span<const Light> _lights;
+    const std::span<const Sphere> _spheres;
+    const RenderSettings _settings;
+
+    float _pixel_spacing = _settings.pixel_spacing;  // Basically resolution of image
+    float _SSAA_factor = _settings.SSAA_factor;      // How much to upsample original image. more -> more time and better image
+    float _displayed_ratio = _settings.ratio;
+    int   _displayed_height = _settings.height;
+    int   _displayed_width  = _displayed_height * _displayed_ratio;
+    float _upsampled_width  = _SSAA_factor * _displayed_width / _pixel_spacing;
+    float _upsampled_height = _SSAA_factor * _displayed_height / _pixel_spacing;
 
     _Camera* _camera;
+    TileScheduler* _scheduler;
+    bool _owns_scheduler;                    // false -> shared, somebody else deletes it
+    Denoiser* _denoiser = nullptr;           // Only with denoise on
+    RenderStats* _stats;                     // Timers, counters and the cost heatmap of the last render
+
+    RayKernel _ray_kernel;
+    ShadeKernel _shade_kernel;
+    TileKernel _tile_kernel;
+    std::string _kernel_name;
+    BVH _bvh;
+    SphereStore _sphere_store;               // Sphere geometry in BVH order, for the SIMD kernels
+    MeshScene _mesh_scene;                   // BVHs over the triangles, the meshes themselves stay in the scene
+    LightCuller _light_culler;
+    bool _many_lights = false;               // Lights get culled by range or sampled, only cast_ray does that
+    bool _wavefront = false;                 // engine is WAVEFRONT and the scene is one it can do
 };
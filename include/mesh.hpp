@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <span>
+#include <string>
+#include <vector>
+#include <raylib.h>
+#include "bvh.hpp"
+#include "objects.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+// Triangle meshes, next to the spheres.
+// * Every vertex and index of a scene is in one shared array each, a Mesh is a range of them.
+//   So a scene with any number of meshes is four flat arrays, which the binary scene format
+//   stores (and maps) as they are
+// * A MeshInstance places a mesh with its own transform and material. Instances only point
+//   at the mesh, a mesh placed a thousand times still has its vertices in memory once
+// * MeshScene (the renderer side) has a BVH per mesh, in object space, and one over the instances.
+//   A ray gets moved into object space per instance, instead of the mesh into world space
+
+// Affine transform. Rows of the 3x3 part and the translation
+struct Affine {
+    Vector3 x = {1, 0, 0};
+    Vector3 y = {0, 1, 0};
+    Vector3 z = {0, 0, 1};
+    Vector3 translation = {0, 0, 0};
+
+    [[nodiscard]] inline Vector3 point(const Vector3& p) const { return direction(p) + translation; }
+    [[nodiscard]] inline Vector3 direction(const Vector3& d) const { return { utils::dot(x, d), utils::dot(y, d), utils::dot(z, d) }; }
+
+    // With the 3x3 part transposed. For the inverse of a transform this moves object space normals to world space
+    [[nodiscard]] inline Vector3 transposed(const Vector3& n) const { return n.x * x + n.y * y + n.z * z; }
+
+    // This first, then next
+    [[nodiscard]] Affine then(const Affine& next) const;
+    [[nodiscard]] Affine inverse() const;
+
+    [[nodiscard]] static Affine scale(const Vector3& s);
+    [[nodiscard]] static Affine rotate(const int& axis, const float& degrees);    // axis 0 -> x, 1 -> y, 2 -> z
+    [[nodiscard]] static Affine translate(const Vector3& t);
+};
+
+struct Mesh {
+    std::uint32_t first_vertex, vertex_count;
+    std::uint32_t first_index, index_count;         // 3 per triangle, relative to first_vertex
+};
+
+struct MeshInstance {
+    std::uint32_t mesh;
+    Affine to_world;
+    Affine to_object;                               // to_world.inverse()
+    _Material material;
+};
+
+// The triangles of a scene, see Scene::meshes
+struct MeshView {
+    std::span<const Vector3> vertices;
+    std::span<const std::uint32_t> indices;
+    std::span<const Mesh> meshes;
+    std::span<const MeshInstance> instances;
+};
+
+// Reads the v and f lines of an OBJ file (or of an inline mesh of a scene) into vertices and indices.
+// Faces with more than 3 corners get fanned, negative indices count from the last vertex,
+// texture coordinates and normals after a / are ignored. Everything else gets skipped.
+// Returns false (and prints why) when the file cant be read or a face is malformed
+[[nodiscard]] bool load_obj(const std::string& path, std::vector<Vector3>& vertices, std::vector<std::uint32_t>& indices);
+[[nodiscard]] bool read_obj_line(const std::string& command, std::istream& line, const std::size_t& first_vertex,
+                                 std::vector<Vector3>& vertices, std::vector<std::uint32_t>& indices);
+
+// Where a ray hit a mesh, see MeshScene::surface
+struct MeshHit {
+    int instance;
+    std::uint32_t triangle;
+    float t;
+};
+
+// The acceleration structures over the meshes of a scene
+class MeshScene {
+public:
+    void build(const MeshView& view);
+
+    [[nodiscard]] inline bool empty() const { return _instances.empty(); }
+    [[nodiscard]] inline std::span<const MeshInstance> instances() const { return _instances; }
+
+    // Closest hit closer than t_max, which shrinks to it
+    [[nodiscard]] bool intersect(const Ray& ray, float& t_max, MeshHit& hit, stats::Counters& counters) const;
+
+    // Any hit closer than t_max
+    [[nodiscard]] bool occluded(const Ray& ray, const float& t_max, stats::Counters& counters) const;
+
+    // Point and normal of a hit, the normal facing against the ray
+    void surface(const Ray& ray, const MeshHit& hit, Vector3& point, Vector3& normal) const;
+
+    [[nodiscard]] inline const _Material& material(const MeshHit& hit) const { return _instances[hit.instance].material; }
+
+private:
+    template <bool ANY_HIT>
+    [[nodiscard]] bool traverse(const Ray& ray, float& t_max, MeshHit& hit, stats::Counters& counters) const;
+
+private:
+    struct Accel {
+        BVH bvh;                                    // Leaves index triangles relative to first_triangle
+        std::uint32_t first_triangle;
+        std::uint32_t first_vertex;
+    };
+
+    std::span<const Vector3> _vertices;
+    std::span<const MeshInstance> _instances;
+    std::vector<std::uint32_t> _triangles;          // The indices of every mesh, triangles in the order of its BVH
+    std::vector<Accel> _accels;                     // Per mesh
+    BVH _instance_bvh;
+};
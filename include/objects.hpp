@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <raylib.h>
+#include "bvh.hpp"
 #include "utils.hpp"
 
 // For more information:
@@ -17,10 +18,12 @@ struct _Material {
     float scattering_constant;        // How much the object is like a mirror. 1 is a perfect mirror. 0.5 is a little blurred mirror
 };
 
+// Not const for the same reason, an animation moves them
 struct Light {
-    const Vector3 position;
-    const float specular_component; // Is float intensity in raytracing series. Acts the same as specular_reflection but it's global on all objects hit by this light
-    const float diffuse_component;  // Is float intensity in raytracing series. Acts the same as diffuse_reflection but it's global on all objects hit by this light
+    Vector3 position;
+    float specular_component;       // Is float intensity in raytracing series. Acts the same as specular_reflection but it's global on all objects hit by this light
+    float diffuse_component;        // Is float intensity in raytracing series. Acts the same as diffuse_reflection but it's global on all objects hit by this light
+    float range = 0;                // Fades out towards this distance and doesnt reach past it. 0 -> reaches everything, see light_culler.hpp
 };
 
 struct Sphere {
@@ -31,6 +34,10 @@ struct Sphere {
     inline Sphere(const Vector3& c, const float& r, const _Material& m) : center(c), radius(r), material(m) { }
     inline Sphere();
 
+    [[nodiscard]] inline AABB bounds() const {
+        return { center - Vector3{radius, radius, radius}, center + Vector3{radius, radius, radius} };
+    }
+
     // http://www.lighthouse3d.com/tutorials/maths/ray-sphere-intersection/
     // ray_t is the mulitplier for the direction
     // ray = origin + ray_t * direction
@@ -53,3 +60,11 @@ struct Sphere {
         }
     }
 };
+
+// What a ray hit, everything shading needs from it
+struct SurfaceHit {
+    Vector3 point;
+    Vector3 normal;                 // Unit length. Out of a sphere, against the ray for a triangle
+    const _Material* material;
+    int object;                     // Sphere index, sphere count + instance index for a triangle
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "scheduler.hpp"
+
+struct CommandLine {
+    std::string scene_path;                 // Empty -> the built in scene
+    std::string save_scene_path;            // Save the scene as binary there and exit
+    std::string animation_path;             // Render the frames of this animation (see animation.hpp)
+    int first_frame = 0;                    // Only these frames of it, the ones before still get applied
+    int last_frame = -1;                    // -1 -> the last one
+    bool interactive = false;               // Move the camera around in the window, see interactive.hpp
+
+    // Distributed rendering, see distributed.hpp
+    std::string coordinate_address;         // Not empty -> coordinate workers, listening on this [HOST:]PORT (port 0 -> any free one)
+    int spawn_workers = 0;                  // Local workers the coordinator starts itself
+    std::string worker_address;             // Not empty -> be a worker of the coordinator at HOST:PORT
+
+    // Render server, see server.hpp
+    std::string serve_address;              // Not empty -> serve on this [HOST:]PORT or socket path
+    std::string client_address;             // Not empty -> render on the server at HOST:PORT or socket path
+    Tile region = { 0, 0, 0, 0 };           // Only this part of the image (client only), empty -> all of it
+
+    // Applied on top of the scene settings, in order (see apply_setting)
+    std::vector<std::pair<std::string, std::string>> settings;
+};
+
+// Fills command_line from argv. Returns false when the program should stop
+// (--help, or a bad argument, which also gets printed)
+[[nodiscard]] bool parse_arguments(const int& argc, char** argv, CommandLine& command_line, int& exit_code);
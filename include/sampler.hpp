@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <raylib.h>
+
+// RANDOM:          every number is a hash of (seed, pixel, sample, dimension), plain white noise
+// LOW_DISCREPANCY: the samples of one pixel walk a Kronecker (R2 / R3) sequence, randomly shifted
+//                  per pixel and dimension. Same cost, but the samples of a pixel spread out evenly,
+//                  so it converges with fewer of them
+enum class SamplerMode {
+    RANDOM,
+    LOW_DISCREPANCY
+};
+
+// Dimensions used by the tracer. Every bounce gets its own, so the numbers of
+// different bounces are never correlated. The kinds are interleaved (see of), so however
+// deep the reflections go one kind never runs into the next
+namespace sampler_dimension {
+    constexpr std::uint32_t PIXEL = 0;          // Primary rays only, so it is the dimension itself
+    constexpr std::uint32_t REFLECTION = 1;
+    constexpr std::uint32_t LIGHT = 2;          // Picking lights (light_samples)
+    constexpr std::uint32_t ROULETTE = 3;       // Following a reflection with russian roulette
+    constexpr std::uint32_t KINDS = 4;
+
+    // The dimension of kind at this bounce
+    [[nodiscard]] constexpr std::uint32_t of(const std::uint32_t& kind, const int& bounce) {
+        return KINDS * static_cast<std::uint32_t>(bounce) + kind;
+    }
+}
+
+// Set by the tracing functions when a sample takes a random decision (a blurred reflection,
+// picking lights, roulette). Reset before every sample by the tile loop that records the features, see denoiser.hpp
+namespace denoise {
+    inline thread_local bool noisy = false;
+}
+
+// Counter based sampler: nothing is stored between calls, every number is a pure function of
+// (seed, pixel, sample, dimension). So any thread can render any pixel in any order and the image
+// stays the same, and rand() (global state, locks) is not needed.
+// https://nullprogram.com/blog/2018/07/31/
+// http://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+class Sampler {
+public:
+    inline Sampler(const std::uint32_t& seed, const std::uint32_t& pixel, const std::uint32_t& sample, const SamplerMode& mode)
+        : _key(hash(seed ^ hash(pixel ^ hash(0x9E3779B9u + sample)))),
+          _pixel_key(hash(seed ^ hash(pixel))),
+          _sample(sample), _mode(mode) { }
+
+    // Sub pixel offset, both in [0, 1)
+    [[nodiscard]] inline Vector2 pixel_offset() const {
+        return { get(sampler_dimension::PIXEL, 0, R2[0]), get(sampler_dimension::PIXEL, 1, R2[1]) };
+    }
+
+    // Three numbers in [0, 1) for perturbing a reflection at this bounce
+    [[nodiscard]] inline Vector3 reflection_jitter(const int& bounce) const {
+        const std::uint32_t dimension = sampler_dimension::of(sampler_dimension::REFLECTION, bounce);
+        return { get(dimension, 0, R3[0]), get(dimension, 1, R3[1]), get(dimension, 2, R3[2]) };
+    }
+
+    // A single number in [0, 1) for any other dimension
+    [[nodiscard]] inline float uniform(const std::uint32_t& dimension) const {
+        return get(dimension, 0, R1);
+    }
+
+    [[nodiscard]] inline std::uint32_t sample() const { return _sample; }
+
+    // https://github.com/skeeto/hash-prospector, lowbias32
+    [[nodiscard]] static inline std::uint32_t hash(std::uint32_t x) {
+        x ^= x >> 16; x *= 0x7feb352du;
+        x ^= x >> 15; x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    [[nodiscard]] static inline float to_float(const std::uint32_t& x) {
+        return (x >> 8) * 0x1p-24f;
+    }
+
+private:
+    [[nodiscard]] inline float get(const std::uint32_t& dimension, const std::uint32_t& component, const float& alpha) const {
+        if (_mode == SamplerMode::RANDOM)
+            return to_float(hash(_key ^ hash(dimension * 4 + component)));
+
+        // Same shift for every sample of the pixel (Cranley Patterson rotation)
+        float x = to_float(hash(_pixel_key ^ hash(dimension * 4 + component))) + _sample * alpha;
+        return x - std::floor(x);
+    }
+
+private:
+    static constexpr float R1 = 0.6180339887f;
+    static constexpr float R2[2] = { 0.7548776662f, 0.5698402910f };
+    static constexpr float R3[3] = { 0.8191725134f, 0.6710436067f, 0.5497004779f };
+
+    std::uint32_t _key;
+    std::uint32_t _pixel_key;
+    std::uint32_t _sample;
+    SamplerMode _mode;
+};
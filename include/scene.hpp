@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "camera.hpp"
+#include "mesh.hpp"
+#include "objects.hpp"
+#include "settings.hpp"
+
+// Spheres, lights, camera and render settings, everything needed to render a frame.
+// Two file formats:
+// * text, for writing scenes by hand. See scenes/default.scene for the syntax
+// * binary, the sphere and light arrays are stored exactly like they are in memory, so the file
+//   gets mmaped and the arrays are used in place. No parsing, no copying, a multi million sphere
+//   scene loads in milliseconds. Made from any scene with --save-scene
+// load() tells them apart by the magic number, not the extension
+class Scene {
+public:
+    Scene() = default;
+    Scene(std::vector<Sphere> spheres, std::vector<Light> lights);
+
+    // Returns false (and prints why) when the file cant be read or is malformed
+    [[nodiscard]] static bool load(const std::string& path, Scene& scene);
+    [[nodiscard]] bool save_binary(const std::string& path) const;
+
+    // The binary format in memory, for sending a scene to the workers of a distributed render.
+    // view false -> without the camera and the settings a render server job brings along (resolution, output, ...),
+    // so every view of a scene is the same bytes and the server keeps one copy (see server.hpp)
+    [[nodiscard]] std::string to_binary(const bool& view = true) const;
+    [[nodiscard]] static bool from_binary(const std::string& bytes, Scene& scene);
+
+    // "set <key> <value>", gets remembered so a saved binary scene keeps its settings
+    [[nodiscard]] bool set(const std::string& key, const std::string& value);
+
+    [[nodiscard]] inline std::span<const Sphere> spheres() const { return _spheres; }
+    [[nodiscard]] inline std::span<const Light> lights() const { return _lights; }
+    [[nodiscard]] inline MeshView meshes() const { return { _vertices, _indices, _meshes, _instances }; }
+
+public:
+    _Camera camera;
+    RenderSettings settings;
+
+private:
+    [[nodiscard]] bool load_text(const std::string& path);
+    [[nodiscard]] bool load_binary(const std::string& path, const int& fd, const std::size_t& size);
+    [[nodiscard]] bool read_binary(const char* bytes, const std::size_t& size, const std::string& name);
+
+private:
+    // Unmaps the file when the scene goes away
+    struct Mapping {
+        void* data;
+        std::size_t size;
+        ~Mapping();
+    };
+
+    std::vector<Sphere> _sphere_storage;    // Empty for a mapped scene
+    std::vector<Light> _light_storage;
+    std::vector<Vector3> _vertex_storage;
+    std::vector<std::uint32_t> _index_storage;
+    std::vector<Mesh> _mesh_storage;
+    std::vector<MeshInstance> _instance_storage;
+    std::unique_ptr<Mapping> _mapping;
+
+    std::span<const Sphere> _spheres;
+    std::span<const Light> _lights;
+    std::span<const Vector3> _vertices;
+    std::span<const std::uint32_t> _indices;
+    std::span<const Mesh> _meshes;
+    std::span<const MeshInstance> _instances;
+    std::vector<std::pair<std::string, std::string>> _set_lines;
+};
+
+// The material properties of a line ("albedo r g b", "ambient a", "diffuse d", "specular s",
+// "exponent e", "scattering s", any of them in any order) on top of material.
+// false when there is something else or a value is missing
+[[nodiscard]] bool read_material(std::istream& line, _Material& material);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rectangle of the frame, [x0, x1) x [y0, y1)
+struct Tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Gets called once per tile. thread_id is in [0, thread_count)
+using TileJob = std::function<void(const Tile& tile, const int& thread_id)>;
+
+// Persistent thread pool that renders tiles with work stealing.
+// Every thread gets a contiguous chunk of the tiles (good locality),
+// pops from the front of its own queue and, when it runs dry, steals from the
+// back of somebody elses queue. This way expensive tiles (mirrors, lots of bounces)
+// get balanced out across the cores instead of one thread finishing last.
+// The calling thread works as thread 0, so a thread count of 1 spawns nothing.
+class TileScheduler {
+public:
+    explicit TileScheduler(const int& thread_count = 0); // 0 -> every core
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator = (const TileScheduler&) = delete;
+
+    // Blocks until every tile is done
+    void run(const std::vector<Tile>& tiles, const TileJob& job);
+
+    [[nodiscard]] int thread_count() const { return _thread_count; }
+
+    // Splits a width x height frame into tile_size x tile_size tiles (row major)
+    [[nodiscard]] static std::vector<Tile> split(const int& width, const int& height, const int& tile_size);
+
+private:
+    void worker_loop(const int thread_id);
+    void work(const int& thread_id);
+    [[nodiscard]] bool next_tile(const int& thread_id, int& tile);
+
+private:
+    // Padded to a cacheline so the queues dont false share
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<int> tiles;
+    };
+
+    int _thread_count;
+    std::vector<std::thread> _threads;
+    std::unique_ptr<WorkQueue[]> _queues;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::vector<Tile>* _tiles = nullptr;
+    const TileJob* _job = nullptr;
+    std::uint64_t _generation = 0;
+    int _busy = 0;
+    bool _stop = false;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+#include "camera.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+
+class RayTracingManager;
+
+// A render server (--serve [HOST:]PORT|PATH) that keeps scenes loaded, with their BVHs and kernels built,
+// so a client that renders the same scene again only pays for the tracing.
+// * A client LOADs a scene (the binary scene format) and gets a handle. Loading the same bytes again
+//   gives the same handle without building anything
+// * Then it sends RENDER jobs against the handle, camera and resolution of its own, and gets the pixels back.
+//   Jobs queue up across every client and run one after the other, each on every core
+// * Scenes that dont fit in server_memory together get dropped, least recently used first.
+//   A job for a dropped scene fails and the client has to load it again. A scene bigger than server_memory
+//   on its own gets refused before it is read
+// A port only takes connections from this machine (127.0.0.1) unless it comes with a host, 0.0.0.0:PORT for every one.
+// There is no authentication, a scene is whatever a client sends
+// The protocol is the one of the distributed render (distributed.hpp), over TCP or a local socket.
+// --client ADDRESS is a small client, it renders the scene of the command line there instead of here
+namespace server {
+    // Payload of RENDER
+    struct Job {
+        std::uint32_t scene;                // Handle from LOADED
+        _Camera camera;
+        std::int32_t height;                // The resolution, same as the settings of the same names
+        float ratio;
+        float pixel_spacing;
+        std::int32_t SSAA;
+        Tile region;                        // Of the displayed image, the part that gets rendered. Empty -> all of it
+    };
+
+    // The loaded scenes, each with a renderer built for it. The renderers share one thread pool
+    class SceneCache {
+    public:
+        // settings get applied on top of the ones of every loaded scene (--threads, ...)
+        SceneCache(const std::size_t& memory_cap, std::vector<std::pair<std::string, std::string>> settings, TileScheduler& scheduler)
+            : _memory_cap(memory_cap), _settings(std::move(settings)), _scheduler(scheduler) {}
+        ~SceneCache();
+
+        SceneCache(const SceneCache&) = delete;
+        SceneCache& operator = (const SceneCache&) = delete;
+
+        // Loads the scene unless the same bytes already are, and drops scenes until the rest fit.
+        // Returns false (and why in error) when the scene doesnt load
+        [[nodiscard]] bool load(const std::string& bytes, std::uint32_t& handle, std::string& error);
+
+        // The renderer of the scene, nullptr if there is no such scene (anymore). It becomes the most recently used
+        [[nodiscard]] RayTracingManager* find(const std::uint32_t& handle);
+
+        [[nodiscard]] inline std::size_t size() const { return _entries.size(); }
+        [[nodiscard]] inline std::size_t memory() const { return _memory; }
+
+    private:
+        struct Entry {
+            std::uint32_t handle;
+            std::size_t key;                // Hash of the bytes, to skip most of the comparisons
+            std::string bytes;              // As received, a scene is only the same when they are
+            std::size_t memory;             // Estimated
+            Scene* scene;
+            RayTracingManager* renderer;
+        };
+
+        void drop(std::list<Entry>::iterator entry);
+
+    private:
+        std::size_t _memory_cap;
+        std::vector<std::pair<std::string, std::string>> _settings;
+        TileScheduler& _scheduler;
+        std::list<Entry> _entries;          // Most recently used first
+        std::size_t _memory = 0;
+        std::uint32_t _next_handle = 1;
+    };
+
+    // Serves on address ([host:]port, or the path of a local socket, anything with a /) until SIGINT or SIGTERM.
+    // settings get applied on top of every loaded scene. Returns the exit code
+    [[nodiscard]] int serve(const std::string& address, const std::vector<std::pair<std::string, std::string>>& settings);
+
+    // Renders region (empty -> all) of scene, with its camera and resolution, on the server at address
+    // ("host:port" or the path of a local socket) and writes it to the output of the scene. Returns the exit code
+    [[nodiscard]] int request(const std::string& address, const Scene& scene, const Tile& region);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "framebuffer.hpp"
+#include "sampler.hpp"
+
+struct _Camera;
+
+// What to do when the output image already exists
+enum class OverwritePolicy {
+    REFUSE,         // Stop before rendering anything
+    OVERWRITE,
+    UNIQUE          // Write next to it with a number appended
+};
+
+// How the rays of a frame get traced, both give the same image
+enum class RenderEngine {
+    RECURSIVE,      // cast_ray follows every sample depth first through its bounces
+    WAVEFRONT       // A tile of samples goes through every stage together, see wavefront.hpp
+};
+
+// Everything that can be changed without recompiling.
+// A scene file sets these with "set <key> <value>" lines and the command line can override them
+// afterwards (--set key=value), see apply_setting for the keys
+struct RenderSettings {
+    ////// OUTPUT //////
+    bool headless = false;                  // No window (and no GL context), the image only goes to output_path
+    std::string output_path = "";           // Empty -> no file. The extension picks the format (.png, .ppm, .exr)
+    OverwritePolicy overwrite = OverwritePolicy::REFUSE;
+    int band_height = 0;                    // > 0 -> render and write the image this many rows at a time, never all of it in memory. Needs output_path
+
+    bool print_stats = true;                // Stage times, ray counts, ... after the render
+    std::string stats_path = "";            // Also write them as JSON here
+    std::string heatmap_path = "";          // Image of how much work every pixel took (sphere tests + BVH nodes)
+
+    ////// IMAGE //////
+    int   height = 1000;                    // Displayed height, the width follows from ratio
+    float ratio = 16.0 / 9.0;
+    float pixel_spacing = 1;                // Basically resolution of image
+    int   SSAA_factor = 5;                  // How much to upsample original image. more -> more time and better image
+    bool  SSAA_jitter = false;              // Jitter every SSAA sample inside its cell (stratified) instead of a regular grid
+
+    // Adaptive anti aliasing, instead of SSAA_factor^2 samples for every pixel.
+    // Every pixel starts with a few samples and only the noisy ones (or the ones that differ a lot
+    // from their neighbours) get more, up to the max. Done in the same pass, no upsampled image
+    bool  adaptive_sampling = false;
+    int   adaptive_min_samples = 4;
+    int   adaptive_max_samples = 25;
+    float adaptive_threshold = 0.02;        // Luminance error (or neighbour contrast) that still counts as smooth
+
+    std::uint32_t seed = 0;                 // Same seed -> same image, no matter the thread count
+    SamplerMode sampler_mode = SamplerMode::LOW_DISCREPANCY;
+
+    // Many lights: a hit that more than light_samples lights reach only shades light_samples of them,
+    // picked in proportion to how much they would add. Less -> faster and noisier. 0 -> every light, no noise
+    int light_samples = 0;
+
+    // Reflections stop once they cant change the pixel by more than path_cutoff (0 to 1, per channel, see shading::follow).
+    // 0 -> only the ones that get clamped away anyway, same image. roulette > 0 -> the ones that could change it by less than that
+    // only get followed now and then, weighted up so the average stays the same. Noisy, for SSAA or the denoiser to smooth out
+    float path_cutoff = 0.002;              // Half a step of an 8 bit color
+    float roulette = 0;
+
+    // Edge avoiding filter over the noisy samples (blurred reflections, sampled lights) before they get resolved,
+    // so 1x1 or 2x2 SSAA looks about like 5x5. Needs the whole frame, so not for streamed, adaptive or distributed renders
+    bool  denoise = false;
+    int   denoise_passes = 5;               // Each one reaches twice as far as the one before
+    float denoise_strength = 4;             // How many standard deviations of the local noise two colors can be apart and still mix. More -> smoother and blurrier
+
+    ////// PERFORMANCE //////
+    int  thread_count = 0;                  // How many threads render the scene. 0 -> every core
+    int  tile_size = 32;                    // Side of a render tile in pixels
+    FramebufferLayout framebuffer_layout = FramebufferLayout::TILED; // TILED keeps every render tile contiguous
+    bool use_bvh = true;                    // false -> test every sphere for every ray. Slow, only for validating the BVH
+    RenderEngine engine = RenderEngine::RECURSIVE; // Adaptive sampling always uses the recursive one
+    bool incremental = true;                // Animations only trace the tiles a frame can change. false -> every tile, for validating
+    int  encode_queue = 2;                  // Animation frames waiting for the writer thread while the next one traces. 0 -> write on the render thread
+    bool gbuffer = false;                   // Animations keep the first hit of every sample (16 bytes each) and reuse it while no sphere moves
+    bool specialize = true;                 // Use the compile time specialised kernels when the scene fits one. false -> always the generic one
+
+    ////// INTERACTIVE //////
+    // Only used by --interactive, see interactive.hpp
+    float target_fps = 30;                  // The preview while moving gets as coarse as it needs to for this
+    float move_speed = 5;                   // Scene units per second
+
+    ////// DISTRIBUTED //////
+    // Only used by the coordinator of a distributed render (--coordinate), see distributed.hpp
+    int   remote_tile_size = 128;           // Side of the tiles handed to workers, in displayed pixels
+    float worker_timeout = 60;              // Seconds a worker can sit on a tile before it counts as dead
+
+    ////// SERVER //////
+    // Only used by the render server (--serve), see server.hpp
+    int   server_memory = 2048;             // MB the loaded scenes can take, the least recently used ones go first
+};
+
+// Sets one setting by name, the camera ones (fov, max_reflection_depth, ...) included.
+// Returns false (and prints why) for unknown keys or bad values
+[[nodiscard]] bool apply_setting(const std::string& key, const std::string& value, RenderSettings& settings, _Camera& camera);
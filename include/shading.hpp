@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <raylib.h>
+#include "objects.hpp"
+#include "sampler.hpp"
+#include "utils.hpp"
+
+// The pieces of the shading model that the recursive cast_ray and the wavefront renderer share.
+// Both have to do exactly the same float operations, otherwise the images drift apart
+namespace shading {
+    // Background gradient for rays that dont hit anything
+    [[nodiscard]] inline Vector3 sky(const Ray& ray) {
+        Vector3 color_from = {0.5, 0.7, 1.0};
+        Vector3 color_to = {0.8, 0.8, 1.0};
+        float lerp = 0.5 - ray.direction.y;
+
+        return (1 - lerp) * color_from + lerp * color_to;
+    }
+
+    // Mirror ray, blurred by the scattering constant of the material. Only a perfect mirror (1) reflects the same way every sample
+    [[nodiscard]] inline Ray reflection(const Vector3& hit, const Vector3& hit_normal, const Vector3& viewing_direction,
+                                        const _Material& material, const Sampler& sampler, const int& reflection_depth) {
+        if (material.scattering_constant != 1) denoise::noisy = true;
+        Vector3 ray_direction = utils::normalize(utils::reflect(viewing_direction, hit_normal));
+        Vector3 ray_origin = utils::dot(ray_direction, hit_normal) < 0
+                             ? hit - 0.001 * hit_normal : hit + 0.001 * hit_normal;
+
+        Vector3 rand3 = sampler.reflection_jitter(reflection_depth); rand3 *= (1 - material.scattering_constant);
+        ray_direction += utils::dot(ray_direction, hit_normal) < 0 ? ray_direction - rand3: ray_direction + rand3;
+        ray_direction = utils::normalize(ray_direction);
+
+        return { .position = ray_origin, .direction = ray_direction };
+    }
+
+    // How the color a ray brings back ends up in its pixel: clamp(color + offset, low, high) per channel.
+    // A hit returns clamp(local + reflection), and a clamp of a shifted clamp is again one, so that holds
+    // for every ray of the path. high - low is how much the ray can still change the pixel, its weight.
+    // A primary ray is the pixel, the default
+    struct Path {
+        Vector3 offset = {0, 0, 0};
+        Vector3 low = {0, 0, 0};
+        Vector3 high = {1, 1, 1};
+        float scale = 1;                    // 1 / the probability roulette let the path get here
+        Vector3* correction = nullptr;      // Of the pixel, see with_reflection
+
+        explicit Path(Vector3& correction) : correction(&correction) { }
+
+        [[nodiscard]] inline Vector3 pixel(const Vector3& color) const {
+            return {
+                std::clamp(color.x + offset.x, low.x, high.x),
+                std::clamp(color.y + offset.y, low.y, high.y),
+                std::clamp(color.z + offset.z, low.z, high.z)
+            };
+        }
+
+        [[nodiscard]] inline float weight() const {
+            return std::max({ high.x - low.x, high.y - low.y, high.z - low.z }) * scale;
+        }
+    };
+
+    // What a hit does about its reflection, see follow
+    struct Bounce {
+        bool follow = true;
+        Path path;                          // Of the reflection
+        Vector3 stand_in = {0, 0, 0};       // Taken as the reflection when it isnt followed, and what roulette compares against
+        float scale = 1;                    // 1 / the probability of following it
+
+        explicit Bounce(const Path& path) : path(path) { }
+    };
+
+    // Decides whether a hit follows its reflection. Reflections that can change the pixel by cutoff or less
+    // stop, with the color that puts the pixel in the middle of what they could still do standing in for them.
+    // So the pixel is off by less than cutoff, and cutoff 0 only stops the ones that get clamped away anyway.
+    // With roulette, the ones that could change it by less than that only continue with a probability of
+    // weight / roulette. with_reflection then counts what they changed that much more, so the pixel stays
+    // right on average (https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/Russian_Roulette_and_Splitting)
+    [[nodiscard]] inline Bounce follow(const Vector3& local, const Path& path, const float& cutoff, const float& roulette,
+                                       const Sampler& sampler, const int& reflection_depth) {
+        Bounce bounce(path);
+        Path& next = bounce.path;
+        auto narrow = [](const float& local, const float& offset, float& low, float& high) {
+            const float from = std::clamp(offset, low, high), to = std::clamp(1 + offset, low, high);
+            low = std::clamp(local + offset, from, to);
+            high = std::clamp(1 + local + offset, from, to);
+        };
+        narrow(local.x, path.offset.x, next.low.x, next.high.x);
+        narrow(local.y, path.offset.y, next.low.y, next.high.y);
+        narrow(local.z, path.offset.z, next.low.z, next.high.z);
+        next.offset = path.offset + local;
+
+        const float weight = next.weight();
+        if (weight > cutoff && weight >= roulette) return bounce;
+
+        bounce.stand_in = {
+            std::clamp((next.low.x + next.high.x) / 2 - next.offset.x, 0.0f, 1.0f),
+            std::clamp((next.low.y + next.high.y) / 2 - next.offset.y, 0.0f, 1.0f),
+            std::clamp((next.low.z + next.high.z) / 2 - next.offset.z, 0.0f, 1.0f)
+        };
+        if (weight <= cutoff) {
+            bounce.follow = false;
+            return bounce;
+        }
+
+        denoise::noisy = true;
+        const float probability = weight / roulette;
+        bounce.follow = sampler.uniform(sampler_dimension::of(sampler_dimension::ROULETTE, reflection_depth)) < probability;
+        bounce.scale = 1 / probability;
+        next.scale *= bounce.scale;
+        return bounce;
+    }
+
+    // The color of a hit from its local term and its reflection (ignored when the bounce wasnt followed).
+    // A reflection that roulette let through changed the pixel from what the stand in would have given,
+    // that change (and the corrections of the rest of its path) counts scale times. The clamps on the
+    // way to the pixel would cut that off, so it goes into the correction of the path instead
+    [[nodiscard]] inline Vector3 with_reflection(const Vector3& local, const Vector3& reflection, const Bounce& bounce) {
+        if (!bounce.follow) return utils::vecminmax(local + bounce.stand_in);
+        if (bounce.scale != 1) {
+            Vector3& correction = *bounce.path.correction;
+            correction += (bounce.scale - 1) * (bounce.path.pixel(reflection) + correction - bounce.path.pixel(bounce.stand_in));
+        }
+        return utils::vecminmax(local + reflection);
+    }
+
+    // Ray from the hit towards the light, started just off the surface
+    [[nodiscard]] inline Ray shadow_ray(const Vector3& hit, const Vector3& hit_normal, const Vector3& light_direction) {
+        Vector3 shadow_origin = utils::dot(light_direction, hit_normal) < 0 ? hit - 1e-3 * hit_normal : hit + 1e-3 * hit_normal;
+        return { shadow_origin, light_direction };
+    }
+
+    // Phong diffuse and specular terms of one unoccluded light, added to the intensities
+    inline void add_light(const _Material& material, const Light& light, const Vector3& light_direction, const Vector3& hit_normal,
+                          const Vector3& viewing_direction, float& diffuse_lighting_intensity, float& specular_lighting_intensity) {
+        const Vector3 reflection_direction = utils::reflect(light_direction, hit_normal);           // R_m^   (variables from wiki)
+
+        diffuse_lighting_intensity +=  material.diffuse_reflection * light.diffuse_component * std::max(0.0f, utils::dot(light_direction, hit_normal));
+        const float base = std::max(0.0f, utils::dot(reflection_direction, viewing_direction));
+        const float exponent = material.specular_exponent;
+        float pow = exponent >= 0 && exponent <= 65535 && exponent == std::floor(exponent)
+                    ? utils::int_pow(base, static_cast<unsigned int>(exponent)) : std::pow(base, exponent);
+        specular_lighting_intensity += material.specular_reflection * light.specular_component * pow;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <raylib.h>
+#include <span>
+#include <string>
+#include <vector>
+#include "objects.hpp"
+
+// Structure of arrays copy of the sphere geometry, only what the intersection needs.
+// The materials stay in the Sphere array and are looked up with id[] once the closest hit is known.
+// Every array is 64 byte aligned and padded to a multiple of 16, so the SIMD kernels can
+// always load full vectors.
+class SphereStore {
+public:
+    static constexpr int PADDING = 16;
+
+    struct View {
+        const float* x;
+        const float* y;
+        const float* z;
+        const float* radius2;   // radius squared, that is all the test needs
+    };
+
+    SphereStore() { select_kernel(); }
+
+    // order decides where every sphere ends up (the BVH leaf order), empty -> same order as spheres
+    void build(std::span<const Sphere> spheres, const std::vector<int>& order = {});
+
+    // Closest sphere in [first, first + count) that is hit closer than t_max.
+    // Returns its slot (not the sphere index, see id()) and shrinks t_max, -1 if nothing was hit.
+    // Gives exactly the same result as Sphere::intersect in a loop
+    [[nodiscard]] inline int intersect(const Ray& ray, const int& first, const int& count, float& t_max) const {
+        return _kernel(_view, ray, first, count, t_max);
+    }
+
+    [[nodiscard]] inline int id(const int& slot) const { return _ids[slot]; }
+    [[nodiscard]] inline std::size_t size() const { return _size; }
+    [[nodiscard]] inline int lane_count() const { return _lane_count; }
+    [[nodiscard]] inline const std::string& kernel_name() const { return _kernel_name; }
+
+public:
+    using Kernel = int (*)(const View& view, const Ray& ray, const int& first, const int& count, float& t_max);
+
+private:
+    struct Free { void operator () (float* p) const { std::free(p); } };
+    using AlignedArray = std::unique_ptr<float[], Free>;
+
+    void select_kernel();
+
+private:
+    std::size_t _size = 0;
+    AlignedArray _x, _y, _z, _radius2;
+    std::vector<int> _ids;
+    View _view = {};
+
+    Kernel _kernel = nullptr;
+    int _lane_count = 1;
+    std::string _kernel_name;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <raylib.h>
+#include <string>
+#include <vector>
+#include "defines.hpp"
+#include "framebuffer.hpp"
+
+// Where the time of a render goes, without attaching a profiler.
+// * Wall clock timers for every stage of a frame
+// * Counters for rays, sphere tests and BVH nodes. Every render thread bumps its own cacheline
+//   sized block with plain adds, no atomics and no locks. They are only summed after the render
+// * A heatmap of the work (sphere tests + BVH nodes) spent on every displayed pixel
+namespace stats {
+    enum class Stage {
+        SCENE_SETUP,        // BVH and sphere store
+        TRACING,            // Primary rays, with everything they spawn
+        SHADING,            // Only measured apart from tracing when the renderer splits them
+        DENOISE,            // Filtering the noisy samples before they get resolved
+        RESOLVE,            // SSAA downsampling
+        ENCODE,             // Writing the image file
+        DISPLAY,            // Uploading the texture
+        COUNT
+    };
+
+    constexpr int DEPTH_BINS = 16;          // Rays traced per reflection depth, deeper ones go in the last bin
+
+    struct alignas(64) Counters {
+        std::uint64_t primary_rays = 0;
+        std::uint64_t reflection_rays = 0;
+        std::uint64_t stopped_paths = 0;     // Reflections that werent followed, see shading::follow
+        std::uint64_t shadow_rays = 0;
+        std::uint64_t sphere_tests = 0;
+        std::uint64_t triangle_tests = 0;
+        std::uint64_t bvh_nodes = 0;
+        std::uint64_t depth_histogram[DEPTH_BINS] = {};
+
+        // Thread time of the intersection / shadow and shading stages. Only renderers that
+        // run them apart (wavefront) fill these, the wall clock TRACING time gets split by them
+        double tracing_seconds = 0;
+        double shading_seconds = 0;
+
+        void add(const Counters& other);
+
+        // What goes into the heatmap
+        [[nodiscard]] inline std::uint64_t cost() const { return sphere_tests + triangle_tests + bvh_nodes; }
+    };
+
+    namespace detail {
+        inline thread_local Counters* current = nullptr;
+        inline thread_local Counters fallback;
+    }
+
+    // The counters of the calling thread. Threads that arent rendering a tile
+    // (the bench calling cast_ray directly, ...) count into a throwaway block
+    [[nodiscard]] inline Counters& local() {
+        return detail::current ? *detail::current : detail::fallback;
+    }
+}
+
+class RenderStats {
+public:
+    explicit RenderStats(const int& thread_count);
+
+    RenderStats(const RenderStats&) = delete;
+    RenderStats& operator = (const RenderStats&) = delete;
+
+    // Points stats::local() of the calling thread at the block of thread_id until it goes out of scope.
+    // Made at the start of every tile job
+    class Binding {
+    public:
+        explicit Binding(stats::Counters* counters) { stats::detail::current = counters; }
+        ~Binding() { stats::detail::current = nullptr; }
+        Binding(const Binding&) = delete;
+        Binding& operator = (const Binding&) = delete;
+    };
+
+    [[nodiscard]] inline Binding bind(const int& thread_id) { return Binding(&_threads[thread_id]); }
+
+    // Times a stage until it goes out of scope
+    class Timer {
+    public:
+        Timer(RenderStats& stats, const stats::Stage& stage) : _stats(stats), _stage(stage), _start(std::chrono::steady_clock::now()) {}
+        ~Timer() { _stats.add_time(_stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count()); }
+        Timer(const Timer&) = delete;
+        Timer& operator = (const Timer&) = delete;
+
+    private:
+        RenderStats& _stats;
+        stats::Stage _stage;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    [[nodiscard]] inline Timer time(const stats::Stage& stage) { return Timer(*this, stage); }
+    inline void add_time(const stats::Stage& stage, const double& seconds) { _seconds[static_cast<int>(stage)] += seconds; }
+
+    // A fresh zeroed heatmap for a width x height (displayed) image, or a window of one starting at origin
+    void start_heatmap(const int& width, const int& height, const int& origin_x = 0, const int& origin_y = 0);
+
+    // Samples of one pixel can come from different tiles (SSAA blocks straddle tile edges), so this one is atomic
+    inline void add_cost(const int& x, const int& y, const std::uint64_t& cost) {
+        std::atomic_ref<std::uint32_t>(_heatmap.at(x, y)).fetch_add(static_cast<std::uint32_t>(cost), std::memory_order_relaxed);
+    }
+
+    // Only valid once the render is done
+    [[nodiscard]] stats::Counters total() const;
+    [[nodiscard]] double seconds(const stats::Stage& stage) const { return stage_seconds(total())[static_cast<int>(stage)]; }
+
+    void print_summary(std::ostream& out) const;
+    [[nodiscard]] bool write_json(const std::string& path) const;
+
+    // The heatmap scaled to its maximum, black -> red -> yellow -> white
+    [[nodiscard]] T_COLOR heatmap_image() const;
+
+private:
+    using StageSeconds = std::array<double, static_cast<int>(stats::Stage::COUNT)>;
+
+    // The timed stages, with TRACING split into tracing and shading when the counters know how
+    [[nodiscard]] StageSeconds stage_seconds(const stats::Counters& counters) const;
+
+private:
+    std::vector<stats::Counters> _threads;
+    StageSeconds _seconds = {};
+    Framebuffer<std::uint32_t> _heatmap;
+};
@@ -7,11 +7,13 @@
 #include <raylib.h>
 #include <iostream>
 #include <math.h>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <iomanip>
 #include <sys/stat.h>
 #include "defines.hpp"
+#include "framebuffer.hpp"
 
 
 ////// VECTOR OPERATOR OVERLOADING //////
@@ -64,6 +66,10 @@ namespace utils {
             return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
         }
 
+        inline Vector3 cross(const Vector3& v1, const Vector3& v2) {
+            return { v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x };
+        }
+
         inline float length(const Vector3& v) {
             return std::sqrt(utils::dot(v, v));
         }
@@ -80,8 +86,9 @@ namespace utils {
         }
 
     ////// VECTOR //////
+        // Clamped, a pixel averaged from roulette corrected samples (see shading::with_reflection) can leave [0, 1]
         inline Color vec_to_color(const Vector3& v) {
-            return Color(255 * v.x, 255 * v.y, 255 * v.z, 255);
+            return Color(255 * std::clamp(v.x, 0.0f, 1.0f), 255 * std::clamp(v.y, 0.0f, 1.0f), 255 * std::clamp(v.z, 0.0f, 1.0f), 255);
         }
 
         inline Vector3 vecmin(const float& f, const Vector3& v) {
@@ -111,6 +118,18 @@ namespace utils {
             return c;
         }
 
+        // x^n by squaring, log2(n) multiplies. std::pow is a lot slower for the big
+        // specular exponents (1425 -> 15 multiplies)
+        inline float int_pow(float x, unsigned int n) {
+            float result = 1;
+            while (n) {
+                if (n & 1) result *= x;
+                x *= x;
+                n >>= 1;
+            }
+            return result;
+        }
+
         // Takes in multiple floats and outputs the smallest one
         inline float min(const std::vector<float>& mins) {
             float min_value = std::numeric_limits<float>::max();
@@ -141,15 +160,20 @@ namespace utils {
               return (stat (PATH.c_str(), &buffer) == 0); 
         }
 
-        inline float random_num(const float& min, const float& max) {
-            const double random = ((double) rand() / (RAND_MAX));
-            const double range = max - min;
-            return (random * range + min);
-        }
-
+        // Safe to call from multiple threads, the lines wont get mixed up.
+        // Only redraws (and flushes) when the shown percentage changes, not on every call
         inline void progress_bar(const std::string& description, const float& value, const float& max_value, const int& bar_length) {
+            static std::mutex mutex;
+            static int shown = -1;          // Whole percent that is on screen
+            std::lock_guard<std::mutex> lock(mutex);
+
             double percentage = static_cast<double>(value) / max_value;
             int pos = static_cast<int>(bar_length * percentage);
+            const bool done = value / max_value == 1.0f;
+
+            const int percent = static_cast<int>(percentage * 100);
+            if (percent == shown && !done) return;
+            shown = done ? -1 : percent;
 
             std::cout << description << ": [";
             for (int i = 0; i < bar_length; ++i) {
@@ -159,33 +183,39 @@ namespace utils {
             std::cout << "] " << std::fixed << std::setprecision(2) << percentage * 100.0 << "%\r";
             std::cout.flush();
 
-            if (value / max_value == 1.0f) std::cout << "\n";
+            if (done) std::cout << "\n";
         }
 
     ////// DEPENDENT //////
         // This function does the following:
         // * Anti aliasing (SSAA)
-        // * Flatten pixels (2D vector) to a 1D vector
+        // * Flatten pixels (any layout, or a window of the frame) to a row major image
         // * Convert Vector3 to color
-        inline T_COLOR adjust_pixels(const T_PIXEL& pixels, const int& SSAA_downscale) {
-            int new_width = static_cast<int>(pixels.front().size() / SSAA_downscale);
-            int new_height = static_cast<int>(pixels.size() / SSAA_downscale);
-            
-            T_COLOR adjusted_pixels;
-            std::vector<Vector3> averaging_pixels;
+        // Into an image that already exists (only reallocated when its size is off), for sequences
+        inline void adjust_pixels(const T_PIXEL& pixels, const int& SSAA_downscale, T_COLOR& adjusted_pixels, const bool& show_progress = true) {
+            int new_width = static_cast<int>(pixels.width() / SSAA_downscale);
+            int new_height = static_cast<int>(pixels.height() / SSAA_downscale);
+            const float sample_weight = 1.0f / (SSAA_downscale * SSAA_downscale);
+
+            if (adjusted_pixels.width() != new_width || adjusted_pixels.height() != new_height || adjusted_pixels.layout() != FramebufferLayout::ROW_MAJOR)
+                adjusted_pixels = T_COLOR(new_width, new_height);
 
             for (int y = 0; y < new_height; y++) {
-                utils::progress_bar("Anti Aliasing  ", y, new_height - 1, 50);
+                if (show_progress) utils::progress_bar("Anti Aliasing  ", y, new_height - 1, 50);
 
                 for (int x = 0; x < new_width; x++) {
-                    averaging_pixels.clear();
+                    Vector3 clr = {0, 0, 0};
                     for (int i = 0; i < SSAA_downscale; i++)
                         for (int j = 0; j < SSAA_downscale; j++)
-                            averaging_pixels.push_back(pixels[y * SSAA_downscale + i][x * SSAA_downscale + j]);
-                    adjusted_pixels.push_back(utils::vec_to_color(utils::average_color(averaging_pixels)));
+                            clr += pixels.at(pixels.origin_x() + x * SSAA_downscale + j, pixels.origin_y() + y * SSAA_downscale + i);
+                    adjusted_pixels.at(x, y) = utils::vec_to_color(sample_weight * clr);
                 }
             }
+        }
 
+        inline T_COLOR adjust_pixels(const T_PIXEL& pixels, const int& SSAA_downscale, const bool& show_progress = true) {
+            T_COLOR adjusted_pixels;
+            adjust_pixels(pixels, SSAA_downscale, adjusted_pixels, show_progress);
             return adjusted_pixels;
         }
 }
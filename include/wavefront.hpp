@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <raylib.h>
+#include <vector>
+#include "objects.hpp"
+#include "sampler.hpp"
+#include "shading.hpp"
+
+// Buffers of the wavefront renderer (RenderEngine::WAVEFRONT).
+// Instead of following one sample depth first through all its bounces, a whole tile of samples
+// moves through the bounces together. Each stage is one loop over contiguous arrays:
+//   generate  primary rays for every sample of the tile           -> wave 0
+//   intersect every ray of the wave                               -> hits (misses get the sky)
+//   sort      the hits by sphere, so the same material gets shaded back to back
+//   shadows   one shadow ray per hit and light, resolved light by light
+//   shade     Phong terms of every hit
+//   reflect   mirror rays of the reflective hits that can still change the pixel -> the next wave
+// The color of a sample is clamp(local + clamp(local + ...)), so once the last wave is done
+// the local terms get folded back from the deepest wave to the first.
+// https://research.nvidia.com/publication/2013-07_megakernels-considered-harmful-wavefront-path-tracing-gpus
+namespace wavefront {
+    // The rays of one bounce depth, for every sample that got that deep
+    struct Wave {
+        std::vector<Ray> rays;
+        std::vector<int> paths;             // Sample of the tile each ray belongs to
+        std::vector<Vector3> terms;         // Lighting * albedo of the hit, or the sky for a miss
+        std::vector<char> missed;
+        std::vector<shading::Path> routes;  // How the color of the ray gets into the pixel
+        std::vector<shading::Bounce> bounces; // What the hit did about its reflection, for the fold
+
+        inline void clear() { rays.clear(); paths.clear(); terms.clear(); missed.clear(); routes.clear(); bounces.clear(); }
+    };
+
+    struct Hit {
+        int ray;                            // In the current wave
+        const Sphere* sphere;
+        Vector3 point;
+    };
+
+    // Owned by a render thread and reused for every tile it gets, so nothing gets allocated
+    // once the first few tiles went through
+    struct Buffers {
+        // Per sample
+        std::vector<Sampler> samplers;
+        std::vector<Vector3> colors;
+        std::vector<Vector3> corrections;   // See shading::with_reflection
+        std::vector<std::uint64_t> costs;  // Sphere tests + BVH nodes, for the heatmap
+
+        std::vector<Wave> waves;            // [depth]
+
+        // Per hit of the current wave
+        std::vector<Hit> hits;
+        std::vector<Vector3> normals;
+        std::vector<Vector3> viewing_directions;
+        std::vector<float> diffuse;
+        std::vector<float> specular;
+
+        // Per hit and light, hit major
+        std::vector<Ray> shadow_rays;
+        std::vector<float> light_distances;
+        std::vector<char> occluded;
+
+        std::vector<int> last_occluders;    // Per light, see scene_occluded
+    };
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "animation.hpp"
+#include "footprint.hpp"
+#include "image_writer.hpp"
+#include "manager.hpp"
+#include "scene.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+[[nodiscard]] bool animation::load(const std::string& path, const std::size_t& sphere_count, const std::size_t& light_count, std::vector<Frame>& frames) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Couldnt open animation {" << path << "}\n";
+        return false;
+    }
+
+    frames.clear();
+    std::string raw_line;
+    for (int line_number = 1; std::getline(file, raw_line); line_number++) {
+        auto fail = [&](const std::string& why) {
+            std::cerr << "Error: " << path << ":" << line_number << ": " << why << "\n";
+            return false;
+        };
+
+        std::size_t comment = raw_line.find('#');
+        if (comment != std::string::npos) raw_line.erase(comment);
+
+        std::istringstream line(raw_line);
+        std::string command;
+        if (!(line >> command)) continue;
+
+        if (command == "frame") {
+            frames.emplace_back();
+            continue;
+        }
+        if (frames.empty()) return fail("Expected a \"frame\" line first");
+
+        if (command == "sphere") {
+            SphereMove move = { 0, {}, -1 };
+            if (!(line >> move.sphere >> move.center.x >> move.center.y >> move.center.z)) return fail("Expected: sphere <index> <x> <y> <z> [radius]");
+            if (!(line >> move.radius)) move.radius = -1;
+            if (move.sphere >= sphere_count) return fail("The scene has no sphere " + std::to_string(move.sphere));
+            frames.back().spheres.push_back(move);
+        } else if (command == "light") {
+            LightMove move;
+            if (!(line >> move.light >> move.position.x >> move.position.y >> move.position.z)) return fail("Expected: light <index> <x> <y> <z>");
+            if (move.light >= light_count) return fail("The scene has no light " + std::to_string(move.light));
+            frames.back().lights.push_back(move);
+        } else if (command == "material") {
+            MaterialChange change;
+            _Material check;
+            if (!(line >> change.sphere)) return fail("Expected: material <index> [albedo r g b] [ambient a] [diffuse d] [specular s] [exponent e] [scattering s]");
+            if (change.sphere >= sphere_count) return fail("The scene has no sphere " + std::to_string(change.sphere));
+
+            std::getline(line, change.properties);
+            std::istringstream properties(change.properties);
+            if (!read_material(properties, check)) return fail("Expected: material <index> [albedo r g b] [ambient a] [diffuse d] [specular s] [exponent e] [scattering s]");
+            frames.back().materials.push_back(change);
+        } else {
+            return fail("Unknown command {" + command + "}");
+        }
+    }
+
+    if (frames.empty()) {
+        std::cerr << "Error: Animation {" << path << "} has no frames\n";
+        return false;
+    }
+    return true;
+}
+
+// Upsampled pixels whose primary rays can hit something inside bounds, padded by a pixel for the jitter.
+// Projects the corners the same way render_scene shoots the rays. A box completely behind the
+// camera cant be seen, one reaching through the camera plane can cover anything
+[[nodiscard]] Tile RayTracingManager::screen_bounds(const AABB& bounds, const int& width, const int& height) const {
+    const float tan_half_fov = std::tan(_camera->fov / 2.0f);
+    float x_min = std::numeric_limits<float>::max(), x_max = std::numeric_limits<float>::lowest();
+    float y_min = x_min, y_max = x_max;
+    int behind = 0;
+
+    for (int corner = 0; corner < 8; corner++) {
+        const Vector3 p = {
+            corner & 1 ? bounds.max.x : bounds.min.x,
+            corner & 2 ? bounds.max.y : bounds.min.y,
+            corner & 4 ? bounds.max.z : bounds.min.z
+        };
+        const Vector3 d = p - _camera->position;
+        if (d.z > -1e-4f) {
+            behind++;
+            continue;
+        }
+
+        // Inverse of the ray direction in render_scene
+        const float x_image = d.x / (-d.z * _camera->focal_length);
+        const float y_image = d.y / (-d.z * _camera->focal_length);
+        const float x = (x_image / (tan_half_fov * _displayed_ratio) + 1) * _upsampled_width / 2;
+        const float y = (1 - y_image / tan_half_fov) * _upsampled_height / 2;
+
+        x_min = std::min(x_min, x); x_max = std::max(x_max, x);
+        y_min = std::min(y_min, y); y_max = std::max(y_max, y);
+    }
+
+    if (behind == 8) return { 0, 0, 0, 0 };
+    if (behind > 0) return { 0, 0, width, height };
+
+    return {
+        std::clamp(static_cast<int>(std::floor(x_min)) - 1, 0, width),
+        std::clamp(static_cast<int>(std::floor(y_min)) - 1, 0, height),
+        std::clamp(static_cast<int>(std::ceil(x_max)) + 2, 0, width),
+        std::clamp(static_cast<int>(std::ceil(y_max)) + 2, 0, height)
+    };
+}
+
+// Every frame writes output_path with the frame number appended (out.png -> out_0000.png, ...).
+// spheres and lights have to be the memory the manager was made with, they get moved in place.
+// The images go to a writer thread (see image::SequenceWriter), so frame f + 1 gets traced while
+// frame f is encoded. The upsampled pixels stay the same buffer for every frame, thats what
+// lets a frame only trace its dirty tiles
+void RayTracingManager::render_animation(const std::vector<animation::Frame>& frames, std::span<Sphere> spheres, std::span<Light> lights,
+                                         const std::size_t& first, const std::size_t& last) {
+    if (spheres.data() != _spheres.data() || lights.data() != _lights.data()) {
+        std::cerr << "Error: The animated spheres and lights arent the ones being rendered\n";
+        std::exit(EXIT_FAILURE);
+    }
+    if (_settings.adaptive_sampling) std::cerr << "Warning: Animations use SSAA, adaptive sampling is ignored\n";
+
+    const int width  = static_cast<int>(std::ceil(_upsampled_width));
+    const int height = static_cast<int>(std::ceil(_upsampled_height));
+    const int SSAA = static_cast<int>(_SSAA_factor);
+
+    T_PIXEL pixels(width, height, _settings.framebuffer_layout, _settings.tile_size);
+    const std::vector<Tile> tiles = TileScheduler::split(width, height, _settings.tile_size);
+    std::vector<TileFootprint> footprints(tiles.size());
+
+    // Only allocated when asked for, it takes 16 bytes per upsampled pixel.
+    // A sample only knows which sphere it hit, a triangle needs more than that
+    const bool use_gbuffer = _settings.gbuffer && _mesh_scene.empty();
+    if (_settings.gbuffer && !use_gbuffer) std::cerr << "Warning: The G-buffer only holds sphere hits, the scene has meshes so it isnt used\n";
+    GBuffer gbuffer;
+    if (use_gbuffer) gbuffer = GBuffer(width, height, _settings.framebuffer_layout, _settings.tile_size);
+
+    // The features of the tiles that arent traced again stay valid like their pixels.
+    // The filtered frame goes to its own buffer, the next frame builds on the unfiltered one
+    FeatureBuffer features;
+    T_PIXEL denoised;
+    if (_denoiser) {
+        features = FeatureBuffer(width, height, _settings.framebuffer_layout, _settings.tile_size);
+        denoised = T_PIXEL(width, height, _settings.framebuffer_layout, _settings.tile_size);
+    }
+
+    image::SequenceWriter writer(_settings.encode_queue);
+    bool skipped_changes = false;           // The frames before first changed the scene, the first one has to rebuild everything
+
+    for (std::size_t f = 0; f <= last && f < frames.size(); f++) {
+        const auto frame_start = std::chrono::steady_clock::now();
+
+        ////// MOVE //////
+        std::vector<int> moved;
+        std::vector<AABB> old_bounds, new_bounds;
+        for (auto& move : frames[f].spheres) {
+            Sphere& sphere = spheres[move.sphere];
+            moved.push_back(static_cast<int>(move.sphere));
+            old_bounds.push_back(sphere.bounds());
+
+            sphere.center = move.center;
+            if (move.radius >= 0) sphere.radius = move.radius;
+            new_bounds.push_back(sphere.bounds());
+        }
+        for (auto& move : frames[f].lights) lights[move.light].position = move.position;
+        const bool lights_moved = !frames[f].lights.empty();
+
+        // Materials only change what hits them look like, the hits stay
+        std::vector<int> recolored;
+        for (auto& change : frames[f].materials) {
+            std::istringstream properties(change.properties);
+            (void)read_material(properties, spheres[change.sphere].material);
+            recolored.push_back(static_cast<int>(change.sphere));
+        }
+
+        if (f < first) {
+            skipped_changes = skipped_changes || !moved.empty() || lights_moved || !recolored.empty();
+            continue;
+        }
+
+        std::string path;
+        if (!image::resolve_path(image::frame_path(_settings.output_path, static_cast<int>(f)), _settings.overwrite, path)) {
+            (void)writer.finish();
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (!moved.empty() || skipped_changes) build_acceleration();
+        if (lights_moved || skipped_changes) build_lights();
+        if (!recolored.empty() || skipped_changes) select_kernels();    // A sphere can turn into a mirror (or stop being one)
+        skipped_changes = false;
+
+        // Where the primary rays can see the moved spheres, before and after
+        std::vector<Tile> screen;
+        for (std::size_t m = 0; m < moved.size(); m++) {
+            screen.push_back(screen_bounds(old_bounds[m], width, height));
+            screen.push_back(screen_bounds(new_bounds[m], width, height));
+        }
+
+        ////// DIRTY TILES //////
+        std::vector<Tile> dirty_tiles;
+        std::vector<TileFootprint*> dirty_footprints;
+        std::vector<bool> record;           // The primary rays of the tile can hit something else now
+        for (std::size_t t = 0; t < tiles.size(); t++) {
+            const Tile& tile = tiles[t];
+            const TileFootprint& footprint = footprints[t];
+            bool dirty = f == first || !_settings.incremental || (lights_moved && footprint.lit);
+            bool primary = f == first;
+
+            for (const int& sphere : recolored) dirty = dirty || footprint.touched(sphere);
+
+            for (std::size_t m = 0; m < moved.size() && !dirty; m++) {
+                // Pad the new position a bit, the recorded rays start 1e-3 off the surfaces
+                AABB padded = new_bounds[m];
+                padded.grow(new_bounds[m].min - Vector3{1e-2f, 1e-2f, 1e-2f});
+                padded.grow(new_bounds[m].max + Vector3{1e-2f, 1e-2f, 1e-2f});
+                const Sphere& sphere = spheres[moved[m]];
+
+                dirty = footprint.touched(moved[m]) || padded.overlaps(footprint.reflections);
+                for (std::size_t l = 0; l < footprint.shadows.size() && !dirty; l++)
+                    dirty = footprint.may_shadow(l, _lights[l].position, sphere.center, sphere.radius + 1e-2f);
+            }
+
+            // Not part of the loop above, it stops at the first reason and a G-buffer needs to know this one
+            for (std::size_t m = 0; m < moved.size() && !primary; m++)
+                for (const Tile& s : {screen[2 * m], screen[2 * m + 1]})
+                    primary = primary || (s.x0 < tile.x1 && tile.x0 < s.x1 && s.y0 < tile.y1 && tile.y0 < s.y1);
+
+            if (!dirty && !primary) continue;
+            dirty_tiles.push_back(tile);
+            dirty_footprints.push_back(&footprints[t]);
+            record.push_back(primary);
+        }
+
+        ////// RENDER //////
+        _stats->start_heatmap(width / SSAA, height / SSAA);
+        {
+            const auto timer = _stats->time(stats::Stage::TRACING);
+            trace_tiles(dirty_tiles, pixels, dirty_footprints, true, use_gbuffer ? &gbuffer : nullptr, record, _denoiser ? &features : nullptr);
+        }
+        if (_denoiser) {
+            const auto timer = _stats->time(stats::Stage::DENOISE);
+            _denoiser->filter(pixels, features, denoised, *_scheduler);
+        }
+
+        // Waits when the writer is queue_size frames behind
+        T_COLOR& colors = writer.acquire();
+        {
+            const auto timer = _stats->time(stats::Stage::RESOLVE);
+            utils::adjust_pixels(_denoiser ? denoised : pixels, SSAA, colors);
+        }
+        writer.submit(colors, path);
+        if (writer.failed()) {
+            (void)writer.finish();
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::cout << "Frame " << f << ": traced " << dirty_tiles.size() << " / " << tiles.size() << " tiles";
+        if (use_gbuffer) std::cout << " (" << std::count(record.begin(), record.end(), false) << " from the G-buffer)";
+        std::cout << " in "
+                  << std::fixed << std::setprecision(3)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count() << " s -> " << path << "\n";
+    }
+
+    // ENCODE is the writer threads time, with a queue it overlaps TRACING instead of adding to it
+    const bool written = writer.finish();
+    _stats->add_time(stats::Stage::ENCODE, writer.encode_seconds());
+    if (!written) std::exit(EXIT_FAILURE);
+    if (_settings.encode_queue > 0)
+        std::cout << "Writer: " << std::fixed << std::setprecision(3) << writer.encode_seconds() << " s encoding next to the tracing, "
+                  << writer.wait_seconds() << " s waited for it\n";
+
+    report_stats();
+}
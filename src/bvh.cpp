@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "bvh.hpp"
+
+namespace {
+    constexpr int BIN_COUNT = 16;
+
+    struct Bin {
+        AABB bounds;
+        int count = 0;
+    };
+
+    inline float axis(const Vector3& v, const int& a) {
+        return a == 0 ? v.x : (a == 1 ? v.y : v.z);
+    }
+
+    struct Builder {
+        const std::vector<AABB>& bounds;
+        std::vector<Vector3> centers;
+        std::vector<BVHNode>& nodes;
+        std::vector<int>& indices;
+        const int max_leaf_size;
+
+        void build(const int node_index, const int begin, const int end, const int depth) {
+            AABB node_bounds, center_bounds;
+            for (int i = begin; i < end; i++) {
+                node_bounds.grow(bounds[indices[i]]);
+                center_bounds.grow(centers[indices[i]]);
+            }
+
+            nodes[node_index].bounds = node_bounds;
+            nodes[node_index].first = begin;
+            nodes[node_index].count = end - begin;
+
+            const int count = end - begin;
+            if (count <= 1 || depth >= BVH::MAX_DEPTH - 2) return;
+
+            // Split along the longest axis of the centers
+            Vector3 extent = center_bounds.max - center_bounds.min;
+            int split_axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            float axis_min = axis(center_bounds.min, split_axis);
+            float axis_extent = axis(extent, split_axis);
+
+            int middle;
+            if (axis_extent <= 0) {
+                // Every center is in the same spot, SAH cant help. Split by count
+                if (count <= max_leaf_size) return;
+                middle = begin + count / 2;
+            } else {
+                const float scale = BIN_COUNT / axis_extent;
+                auto bin_of = [&](const int& primitive) {
+                    return std::min(BIN_COUNT - 1, static_cast<int>((axis(centers[primitive], split_axis) - axis_min) * scale));
+                };
+
+                std::array<Bin, BIN_COUNT> bins;
+                for (int i = begin; i < end; i++) {
+                    Bin& bin = bins[bin_of(indices[i])];
+                    bin.bounds.grow(bounds[indices[i]]);
+                    bin.count++;
+                }
+
+                // Sweep from the right, then from the left to evaluate every plane between bins
+                std::array<float, BIN_COUNT - 1> right_cost;
+                AABB right_bounds; int right_count = 0;
+                for (int b = BIN_COUNT - 1; b > 0; b--) {
+                    right_bounds.grow(bins[b].bounds);
+                    right_count += bins[b].count;
+                    right_cost[b - 1] = right_count * right_bounds.area();
+                }
+
+                float best_cost = std::numeric_limits<float>::max();
+                int best_plane = -1;
+                AABB left_bounds; int left_count = 0;
+                for (int b = 0; b < BIN_COUNT - 1; b++) {
+                    left_bounds.grow(bins[b].bounds);
+                    left_count += bins[b].count;
+                    float cost = left_count * left_bounds.area() + right_cost[b];
+                    if (left_count > 0 && left_count < count && cost < best_cost) {
+                        best_cost = cost;
+                        best_plane = b;
+                    }
+                }
+
+                // Traversal step costs about as much as a primitive test
+                const float leaf_cost = count * node_bounds.area();
+                if (best_plane < 0 || best_cost >= leaf_cost - node_bounds.area()) {
+                    if (count <= max_leaf_size) return;
+                }
+
+                if (best_plane < 0) {
+                    middle = begin + count / 2;
+                    std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                        [&](const int& a, const int& b) { return axis(centers[a], split_axis) < axis(centers[b], split_axis); });
+                } else {
+                    middle = static_cast<int>(std::partition(indices.begin() + begin, indices.begin() + end,
+                        [&](const int& primitive) { return bin_of(primitive) <= best_plane; }) - indices.begin());
+                }
+            }
+
+            // Left child is the next node, the right one comes after the whole left subtree
+            const int left = static_cast<int>(nodes.size());
+            nodes.push_back({});
+            build(left, begin, middle, depth + 1);
+
+            const int right = static_cast<int>(nodes.size());
+            nodes.push_back({});
+            build(right, middle, end, depth + 1);
+
+            nodes[node_index].first = right;
+            nodes[node_index].count = 0;
+        }
+    };
+}
+
+void BVH::build(const std::vector<AABB>& primitive_bounds, const int& max_leaf_size) {
+    _nodes.clear();
+    _indices.resize(primitive_bounds.size());
+    std::iota(_indices.begin(), _indices.end(), 0);
+    if (primitive_bounds.empty()) return;
+
+    Builder builder = {
+        .bounds = primitive_bounds,
+        .centers = {},
+        .nodes = _nodes,
+        .indices = _indices,
+        .max_leaf_size = std::max(1, max_leaf_size)
+    };
+    builder.centers.reserve(primitive_bounds.size());
+    for (auto& b : primitive_bounds) builder.centers.push_back(b.center());
+
+    _nodes.reserve(2 * primitive_bounds.size());
+    _nodes.push_back({});
+    builder.build(0, 0, static_cast<int>(primitive_bounds.size()), 0);
+    _nodes.shrink_to_fit();
+}
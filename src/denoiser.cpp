@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "denoiser.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define RAYTRACER_X86
+    #include <immintrin.h>
+#endif
+
+namespace {
+    // How different two samples can be before they stop mixing (the weight reaches 0 around 3 tolerances)
+    constexpr float NORMAL_TOLERANCE = 0.3;             // Length of the normal difference
+    constexpr float DEPTH_TOLERANCE = 0.05;             // Relative to the depth, per pixel of tap distance
+    constexpr float ALBEDO_TOLERANCE = 0.1;
+    constexpr float MIN_VARIANCE = 1e-4;                // A flat area still mixes colors this close
+    constexpr float OTHER_OBJECT = 1e4;                 // Object ids are whole numbers, so a tap of another object gets a distance past 8
+
+    constexpr float B3_SPLINE[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    constexpr int VARIANCE_RADIUS = 3;
+    constexpr int BAND_HEIGHT = 8;
+
+    inline float luminance(const float& r, const float& g, const float& b) {
+        return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    }
+
+    // The luminance sums of the pixels [begin, end) of a row over one sample each, q offset by it so x is the pixel.
+    // Only samples of the same object as the pixel count
+    struct VarianceRow {
+        const float *r, *g, *b, *object;
+    };
+    using VarianceKernel = void (*)(const VarianceRow& q, const float* object, float* sum_l, float* sum_l2, float* sum_n, const int& begin, const int& end);
+
+    void variance_scalar(const VarianceRow& q, const float* object, float* sum_l, float* sum_l2, float* sum_n, const int& begin, const int& end) {
+        for (int x = begin; x < end; x++) {
+            const float l = luminance(q.r[x], q.g[x], q.b[x]);
+            const float same = q.object[x] == object[x] ? 1.0f : 0.0f;
+            sum_l[x] += same * l;
+            sum_l2[x] += same * l * l;
+            sum_n[x] += same;
+        }
+    }
+
+#ifdef RAYTRACER_X86
+    // variance_scalar for 8 pixels at once, same operations in the same order
+    __attribute__((target("avx2")))
+    void variance_avx2(const VarianceRow& q, const float* object, float* sum_l, float* sum_l2, float* sum_n, const int& begin, const int& end) {
+        const __m256 lr = _mm256_set1_ps(0.2126f), lg = _mm256_set1_ps(0.7152f), lb = _mm256_set1_ps(0.0722f);
+        const __m256 one = _mm256_set1_ps(1);
+
+        int x = begin;
+        for (; x + 8 <= end; x += 8) {
+            const __m256 r = _mm256_loadu_ps(q.r + x), g = _mm256_loadu_ps(q.g + x), b = _mm256_loadu_ps(q.b + x);
+            const __m256 l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lr, r), _mm256_mul_ps(lg, g)), _mm256_mul_ps(lb, b));
+            const __m256 same = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(q.object + x), _mm256_loadu_ps(object + x), _CMP_EQ_OQ), one);
+            const __m256 counted = _mm256_mul_ps(same, l);
+
+            _mm256_storeu_ps(sum_l + x, _mm256_add_ps(_mm256_loadu_ps(sum_l + x), counted));
+            _mm256_storeu_ps(sum_l2 + x, _mm256_add_ps(_mm256_loadu_ps(sum_l2 + x), _mm256_mul_ps(counted, l)));
+            _mm256_storeu_ps(sum_n + x, _mm256_add_ps(_mm256_loadu_ps(sum_n + x), same));
+        }
+        variance_scalar(q, object, sum_l, sum_l2, sum_n, x, end);
+    }
+#endif
+
+    // Variance of the luminance over the 7x7 samples of the same object around every pixel of the noisy span of row y.
+    // The rest of the row keeps the variance 0 it got in the split
+    void estimate_row(Denoiser::Planes& p, const int& source, const int& y, const VarianceKernel& accumulate) {
+        const int x0 = p.span_x0[y], x1 = p.span_x1[y];
+        const std::size_t row = static_cast<std::size_t>(y) * p.width;
+        float* out = p.variance[source].data() + row;
+        if (x0 >= x1) return;
+
+        thread_local std::vector<float> sum_l, sum_l2, sum_n;
+        sum_l.assign(x1 - x0, 0); sum_l2.assign(x1 - x0, 0); sum_n.assign(x1 - x0, 0);
+        float* const sl = sum_l.data() - x0;
+        float* const sl2 = sum_l2.data() - x0;
+        float* const sn = sum_n.data() - x0;
+        const float* co = p.object.data() + row;
+
+        for (int dy = -VARIANCE_RADIUS; dy <= VARIANCE_RADIUS; dy++) {
+            const int qy = y + dy;
+            if (qy < 0 || qy >= p.height) continue;
+            const std::size_t q_row = static_cast<std::size_t>(qy) * p.width;
+
+            for (int dx = -VARIANCE_RADIUS; dx <= VARIANCE_RADIUS; dx++) {
+                const VarianceRow q = {
+                    p.r[source].data() + q_row + dx, p.g[source].data() + q_row + dx,
+                    p.b[source].data() + q_row + dx, p.object.data() + q_row + dx
+                };
+                accumulate(q, co, sl, sl2, sn, std::max(x0, -dx), std::min(x1, p.width - dx));
+            }
+        }
+
+        // The sample itself is always counted, so sn >= 1
+        for (int x = x0; x < x1; x++) {
+            const float mean = sl[x] / sn[x];
+            out[x] = std::max(0.0f, sl2[x] / sn[x] - mean * mean);
+        }
+    }
+
+    // The planes one tap of a pass reads, offset by the tap so x is the pixel being filtered, and the sums it adds to
+    struct TapRow {
+        const float *r, *g, *b, *variance, *nx, *ny, *nz, *ax, *ay, *az, *depth, *object;
+    };
+    struct CentreRow {
+        const float *luminance, *inverse_luminance2, *nx, *ny, *nz, *ax, *ay, *az, *depth, *inverse_depth2, *object;
+    };
+    struct Sums {
+        float *r, *g, *b, *w, *variance;
+    };
+
+    // Adds tap q to the pixels [begin, end) of the row, weighted by h and by how alike q and the pixel are.
+    // The edge stopping function is (1 - d / 8)^8, which is about exp(-d) and is 0 past 8
+    using TapKernel = void (*)(const TapRow& q, const CentreRow& c, const Sums& s, const int& begin, const int& end, const float& h, const float& inverse_step2);
+
+    inline void tap(const TapRow& q, const CentreRow& c, const Sums& s, const int& x, const float& h, const float& inverse_step2) {
+        const float dl = luminance(q.r[x], q.g[x], q.b[x]) - c.luminance[x];
+        const float dnx = q.nx[x] - c.nx[x], dny = q.ny[x] - c.ny[x], dnz = q.nz[x] - c.nz[x];
+        const float dax = q.ax[x] - c.ax[x], day = q.ay[x] - c.ay[x], daz = q.az[x] - c.az[x];
+        const float dd = q.depth[x] - c.depth[x];
+        const float d_object = q.object[x] - c.object[x];
+
+        const float distance = dl * dl * c.inverse_luminance2[x]
+                             + (dnx * dnx + dny * dny + dnz * dnz) * (1 / (NORMAL_TOLERANCE * NORMAL_TOLERANCE))
+                             + (dax * dax + day * day + daz * daz) * (1 / (ALBEDO_TOLERANCE * ALBEDO_TOLERANCE))
+                             + dd * dd * c.inverse_depth2[x] * inverse_step2
+                             + d_object * d_object * OTHER_OBJECT;
+
+        float w = std::max(0.0f, 1 - distance * 0.125f);
+        w *= w; w *= w; w *= w;
+        w *= h;
+
+        s.r[x] += w * q.r[x];
+        s.g[x] += w * q.g[x];
+        s.b[x] += w * q.b[x];
+        s.w[x] += w;
+        s.variance[x] += w * w * q.variance[x];
+    }
+
+    void taps_scalar(const TapRow& q, const CentreRow& c, const Sums& s, const int& begin, const int& end, const float& h, const float& inverse_step2) {
+        for (int x = begin; x < end; x++) tap(q, c, s, x, h, inverse_step2);
+    }
+
+#ifdef RAYTRACER_X86
+    __attribute__((target("avx2"))) inline __m256 square(const __m256& a) {
+        return _mm256_mul_ps(a, a);
+    }
+
+    __attribute__((target("avx2"))) inline __m256 difference(const float* a, const float* b, const int& x) {
+        return _mm256_sub_ps(_mm256_loadu_ps(a + x), _mm256_loadu_ps(b + x));
+    }
+
+    // tap for 8 pixels at once, same operations in the same order
+    __attribute__((target("avx2")))
+    void taps_avx2(const TapRow& q, const CentreRow& c, const Sums& s, const int& begin, const int& end, const float& h, const float& inverse_step2) {
+        const __m256 normal = _mm256_set1_ps(1 / (NORMAL_TOLERANCE * NORMAL_TOLERANCE));
+        const __m256 albedo = _mm256_set1_ps(1 / (ALBEDO_TOLERANCE * ALBEDO_TOLERANCE));
+        const __m256 other = _mm256_set1_ps(OTHER_OBJECT);
+        const __m256 step2 = _mm256_set1_ps(inverse_step2);
+        const __m256 weight = _mm256_set1_ps(h);
+        const __m256 one = _mm256_set1_ps(1), eighth = _mm256_set1_ps(0.125f), zero = _mm256_setzero_ps();
+        const __m256 lr = _mm256_set1_ps(0.2126f), lg = _mm256_set1_ps(0.7152f), lb = _mm256_set1_ps(0.0722f);
+
+        int x = begin;
+        for (; x + 8 <= end; x += 8) {
+            const __m256 r = _mm256_loadu_ps(q.r + x), g = _mm256_loadu_ps(q.g + x), b = _mm256_loadu_ps(q.b + x);
+            const __m256 l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lr, r), _mm256_mul_ps(lg, g)), _mm256_mul_ps(lb, b));
+            const __m256 dl = _mm256_sub_ps(l, _mm256_loadu_ps(c.luminance + x));
+            const __m256 dn = _mm256_add_ps(_mm256_add_ps(square(difference(q.nx, c.nx, x)), square(difference(q.ny, c.ny, x))), square(difference(q.nz, c.nz, x)));
+            const __m256 da = _mm256_add_ps(_mm256_add_ps(square(difference(q.ax, c.ax, x)), square(difference(q.ay, c.ay, x))), square(difference(q.az, c.az, x)));
+            const __m256 dd = difference(q.depth, c.depth, x);
+            const __m256 d_object = difference(q.object, c.object, x);
+
+            __m256 distance = _mm256_mul_ps(square(dl), _mm256_loadu_ps(c.inverse_luminance2 + x));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(dn, normal));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(da, albedo));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_mul_ps(square(dd), _mm256_loadu_ps(c.inverse_depth2 + x)), step2));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(square(d_object), other));
+
+            __m256 w = _mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(distance, eighth)), zero);
+            w = square(square(square(w)));
+            w = _mm256_mul_ps(w, weight);
+
+            _mm256_storeu_ps(s.r + x, _mm256_add_ps(_mm256_loadu_ps(s.r + x), _mm256_mul_ps(w, r)));
+            _mm256_storeu_ps(s.g + x, _mm256_add_ps(_mm256_loadu_ps(s.g + x), _mm256_mul_ps(w, g)));
+            _mm256_storeu_ps(s.b + x, _mm256_add_ps(_mm256_loadu_ps(s.b + x), _mm256_mul_ps(w, b)));
+            _mm256_storeu_ps(s.w + x, _mm256_add_ps(_mm256_loadu_ps(s.w + x), w));
+            _mm256_storeu_ps(s.variance + x, _mm256_add_ps(_mm256_loadu_ps(s.variance + x), _mm256_mul_ps(square(w), _mm256_loadu_ps(q.variance + x))));
+        }
+        for (; x < end; x++) tap(q, c, s, x, h, inverse_step2);
+    }
+#endif
+
+    // One a trous pass over row y, the taps are 5 x 5 runs of the tap kernel along the row
+    void filter_row(Denoiser::Planes& p, const int& source, const int& y, const int& step, const float& strength, const TapKernel& taps) {
+        const int x0 = p.span_x0[y], x1 = p.span_x1[y];
+        const int target = 1 - source;
+        const std::size_t row = static_cast<std::size_t>(y) * p.width;
+
+        float* out_r = p.r[target].data() + row;
+        float* out_g = p.g[target].data() + row;
+        float* out_b = p.b[target].data() + row;
+        float* out_v = p.variance[target].data() + row;
+        const float* in_r = p.r[source].data();
+        const float* in_g = p.g[source].data();
+        const float* in_b = p.b[source].data();
+        const float* in_v = p.variance[source].data();
+
+        // Outside the noisy span both planes already hold the same, see the split
+        if (x0 >= x1) return;
+
+        // Indexed by x like the planes, only [x0, x1) is there
+        thread_local std::vector<float> sum_r, sum_g, sum_b, sum_w, sum_v, centre_l, inverse_l2;
+        for (auto* sum : { &sum_r, &sum_g, &sum_b, &sum_w, &sum_v, &centre_l, &inverse_l2 }) sum->assign(x1 - x0, 0);
+        const Sums sums = { sum_r.data() - x0, sum_g.data() - x0, sum_b.data() - x0, sum_w.data() - x0, sum_v.data() - x0 };
+        float* const cl = centre_l.data() - x0;
+        float* const cil2 = inverse_l2.data() - x0;
+
+        // A luminance difference of strength standard deviations weighs about exp(-1)
+        for (int x = x0; x < x1; x++) {
+            cl[x] = luminance(in_r[row + x], in_g[row + x], in_b[row + x]);
+            cil2[x] = 1 / (strength * strength * (in_v[row + x] + MIN_VARIANCE));
+        }
+
+        const CentreRow centre = {
+            cl, cil2,
+            p.nx.data() + row, p.ny.data() + row, p.nz.data() + row,
+            p.ax.data() + row, p.ay.data() + row, p.az.data() + row,
+            p.depth.data() + row, p.inverse_depth2.data() + row, p.object.data() + row
+        };
+        const float inverse_step2 = 1.0f / (step * step);
+
+        for (int ty = 0; ty < 5; ty++) {
+            const int qy = y + (ty - 2) * step;
+            if (qy < 0 || qy >= p.height) continue;
+
+            for (int tx = 0; tx < 5; tx++) {
+                const int dx = (tx - 2) * step;
+                const std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(qy) * p.width + dx;
+                const TapRow q = {
+                    in_r + offset, in_g + offset, in_b + offset, in_v + offset,
+                    p.nx.data() + offset, p.ny.data() + offset, p.nz.data() + offset,
+                    p.ax.data() + offset, p.ay.data() + offset, p.az.data() + offset,
+                    p.depth.data() + offset, p.object.data() + offset
+                };
+                taps(q, centre, sums, std::max(x0, -dx), std::min(x1, p.width - dx), B3_SPLINE[tx] * B3_SPLINE[ty], inverse_step2);
+            }
+        }
+
+        // The centre tap always has weight h > 0, so w cant be 0. noisy is 0 or 1
+        const float* noisy = p.noisy.data() + row;
+        for (int x = x0; x < x1; x++) {
+            const float w = sums.w[x];
+            out_r[x] = in_r[row + x] + noisy[x] * (sums.r[x] / w - in_r[row + x]);
+            out_g[x] = in_g[row + x] + noisy[x] * (sums.g[x] / w - in_g[row + x]);
+            out_b[x] = in_b[row + x] + noisy[x] * (sums.b[x] / w - in_b[row + x]);
+            out_v[x] = in_v[row + x] + noisy[x] * (sums.variance[x] / (w * w) - in_v[row + x]);
+        }
+    }
+
+    void row_scalar(Denoiser::Planes& p, const int& source, const int& y, const int& step, const float& strength) {
+        if (step == 0) estimate_row(p, source, y, &variance_scalar);
+        else filter_row(p, source, y, step, strength, &taps_scalar);
+    }
+
+#ifdef RAYTRACER_X86
+    void row_avx2(Denoiser::Planes& p, const int& source, const int& y, const int& step, const float& strength) {
+        if (step == 0) estimate_row(p, source, y, &variance_avx2);
+        else filter_row(p, source, y, step, strength, &taps_avx2);
+    }
+#endif
+}
+
+Denoiser::Denoiser(const int& passes, const float& strength) : _passes(passes), _strength(strength), _kernel(&row_scalar) {
+#ifdef RAYTRACER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) _kernel = &row_avx2;
+#endif
+}
+
+void Denoiser::filter(const T_PIXEL& pixels, const FeatureBuffer& features, T_PIXEL& output, TileScheduler& scheduler) {
+    Planes& p = _planes;
+    p.width = pixels.width();
+    p.height = pixels.height();
+
+    // No pass changes anything, the variance isnt needed either
+    if (_passes == 0) {
+        if (&output != &pixels)
+            for (int y = 0; y < p.height; y++)
+                for (int x = 0; x < p.width; x++)
+                    output.at(output.origin_x() + x, output.origin_y() + y) = pixels.at(pixels.origin_x() + x, pixels.origin_y() + y);
+        return;
+    }
+
+    for (auto* plane : { &p.r[0], &p.r[1], &p.g[0], &p.g[1], &p.b[0], &p.b[1], &p.variance[0], &p.variance[1],
+                         &p.nx, &p.ny, &p.nz, &p.ax, &p.ay, &p.az, &p.depth, &p.inverse_depth2, &p.object, &p.noisy })
+        if (plane->width() != p.width || plane->height() != p.height) *plane = Planes::Plane(p.width, p.height);
+    for (auto* span : { &p.span_x0, &p.span_x1, &p.reach_x0, &p.reach_x1 }) span->resize(p.height);
+
+    std::vector<Tile> bands;
+    for (int y0 = 0; y0 < p.height; y0 += BAND_HEIGHT) bands.push_back({ 0, y0, p.width, std::min(p.height, y0 + BAND_HEIGHT) });
+
+    ////// SPLIT //////
+    scheduler.run(bands, [&](const Tile& band, const int&) {
+        for (int y = band.y0; y < band.y1; y++) {
+            int x0 = p.width, x1 = 0;
+            for (int x = 0; x < p.width; x++)
+                if (features.at(features.origin_x() + x, features.origin_y() + y).noisy) { x0 = std::min(x0, x); x1 = x + 1; }
+            p.span_x0[y] = x0;
+            p.span_x1[y] = x1;
+        }
+    });
+
+    // What the spans read: the last pass taps 2 * 2^(passes - 1) pixels away, the variance 3.
+    // Outside the spans the pixels stay as they are, so no pass reaches further through an earlier one
+    const int reach = std::max(1 << _passes, VARIANCE_RADIUS);
+    for (int y = 0; y < p.height; y++) {
+        int x0 = p.width, x1 = 0;
+        for (int qy = std::max(0, y - reach); qy <= std::min(p.height - 1, y + reach); qy++) {
+            if (p.span_x0[qy] >= p.span_x1[qy]) continue;
+            x0 = std::min(x0, std::max(0, p.span_x0[qy] - reach));
+            x1 = std::max(x1, std::min(p.width, p.span_x1[qy] + reach));
+        }
+        p.reach_x0[y] = x0;
+        p.reach_x1[y] = x1;
+    }
+
+    // Both color planes get the pixels, so nothing outside the spans has to be copied between the passes.
+    // The variance is 0 there, the estimate only fills in the spans
+    scheduler.run(bands, [&](const Tile& band, const int&) {
+        for (int y = band.y0; y < band.y1; y++)
+            for (int x = p.reach_x0[y]; x < p.reach_x1[y]; x++) {
+                const Vector3& color = pixels.at(pixels.origin_x() + x, pixels.origin_y() + y);
+                const DenoiseFeature& f = features.at(features.origin_x() + x, features.origin_y() + y);
+
+                p.r[0].at(x, y) = p.r[1].at(x, y) = color.x;
+                p.g[0].at(x, y) = p.g[1].at(x, y) = color.y;
+                p.b[0].at(x, y) = p.b[1].at(x, y) = color.z;
+                p.variance[0].at(x, y) = p.variance[1].at(x, y) = 0;
+                p.nx.at(x, y) = f.normal.x; p.ny.at(x, y) = f.normal.y; p.nz.at(x, y) = f.normal.z;
+                p.ax.at(x, y) = f.albedo.x; p.ay.at(x, y) = f.albedo.y; p.az.at(x, y) = f.albedo.z;
+                p.depth.at(x, y) = f.depth;
+                p.inverse_depth2.at(x, y) = f.object < 0 || f.depth <= 0 ? 0.0f : 1 / (f.depth * f.depth * DEPTH_TOLERANCE * DEPTH_TOLERANCE);
+                p.object.at(x, y) = static_cast<float>(f.object);
+                p.noisy.at(x, y) = f.noisy ? 1.0f : 0.0f;
+            }
+    });
+
+    ////// PASSES //////
+    scheduler.run(bands, [&](const Tile& band, const int&) {
+        for (int y = band.y0; y < band.y1; y++) _kernel(p, 0, y, 0, _strength);
+    });
+
+    int source = 0;
+    for (int pass = 0; pass < _passes; pass++) {
+        scheduler.run(bands, [&](const Tile& band, const int&) {
+            for (int y = band.y0; y < band.y1; y++) _kernel(p, source, y, 1 << pass, _strength);
+        });
+        source = 1 - source;
+    }
+
+    ////// MERGE //////
+    // Only the spans changed
+    scheduler.run(bands, [&](const Tile& band, const int&) {
+        for (int y = band.y0; y < band.y1; y++) {
+            const int x0 = &output == &pixels ? p.span_x0[y] : 0;
+            const int x1 = &output == &pixels ? p.span_x1[y] : p.width;
+            for (int x = x0; x < x1; x++) {
+                Vector3& color = output.at(output.origin_x() + x, output.origin_y() + y);
+                if (x < p.span_x0[y] || x >= p.span_x1[y]) color = pixels.at(pixels.origin_x() + x, pixels.origin_y() + y);
+                else color = { p.r[source].at(x, y), p.g[source].at(x, y), p.b[source].at(x, y) };
+            }
+        }
+    });
+}
@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <numeric>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "distributed.hpp"
+#include "manager.hpp"
+#include "scene.hpp"
+#include "utils.hpp"
+
+namespace {
+    // Small messages (tiles) shouldnt wait for more data to fill a packet
+    void no_delay(const int& fd) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    // Not inherited by the spawned workers, and optionally non blocking
+    void configure(const int& fd, const bool& non_blocking) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (non_blocking) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+////// CONNECTION //////
+distributed::Connection::Connection(const int& fd, const float& timeout) : _fd(fd), _timeout(timeout) {}
+
+distributed::Connection::~Connection() {
+    close(_fd);
+}
+
+[[nodiscard]] bool distributed::Connection::send(const MessageType& type, const std::uint32_t& tile, const void* data, const std::size_t& size) {
+    const MessageHeader header = { type, tile, size };
+
+    // In one piece, so a small message goes out as one packet
+    std::string message(sizeof(header) + size, '\0');
+    std::memcpy(message.data(), &header, sizeof(header));
+    if (size) std::memcpy(message.data() + sizeof(header), data, size);
+
+    std::size_t sent = 0;
+    while (sent < message.size()) {
+        const ssize_t n = ::send(_fd, message.data() + sent, message.size() - sent, 0);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+
+        // Non blocking socket with a full send buffer, wait until the other end reads some
+        pollfd writable = { _fd, POLLOUT, 0 };
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+            && poll(&writable, 1, _timeout < 0 ? -1 : static_cast<int>(_timeout * 1000)) > 0)
+            continue;
+        return false;
+    }
+    return true;
+}
+
+[[nodiscard]] bool distributed::Connection::receive() {
+    char chunk[1 << 16];
+    int flags = 0;
+
+    // Only the first read can block, the rest takes whatever is already there
+    while (true) {
+        if (too_big()) return false;
+        const ssize_t n = recv(_fd, chunk, sizeof(chunk), flags);
+        if (n > 0) {
+            _received.append(chunk, n);
+            flags = MSG_DONTWAIT;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+// Any of the messages received so far, up to the first one that isnt complete yet
+[[nodiscard]] bool distributed::Connection::too_big() const {
+    MessageHeader header;
+    for (std::size_t offset = 0; _received.size() - offset >= sizeof(header); offset += sizeof(header) + header.size) {
+        std::memcpy(&header, _received.data() + offset, sizeof(header));
+        if (header.size > _max_size) return true;
+        if (_received.size() - offset - sizeof(header) < header.size) return false;
+    }
+    return false;
+}
+
+[[nodiscard]] bool distributed::Connection::next(MessageHeader& header, std::string& payload) {
+    if (_received.size() < sizeof(MessageHeader)) return false;
+    std::memcpy(&header, _received.data(), sizeof(header));
+    if (_received.size() - sizeof(header) < header.size) return false;
+
+    payload.assign(_received, sizeof(header), header.size);
+    _received.erase(0, sizeof(header) + header.size);
+    return true;
+}
+
+////// COORDINATOR //////
+distributed::Coordinator::~Coordinator() {
+    if (_fd >= 0) close(_fd);
+
+    // They got DONE already (or lost the connection), so give them a second to exit.
+    // A hung (or stopped) one gets killed
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    for (pid_t pid : _spawned) {
+        while (waitpid(pid, nullptr, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            break;
+        }
+    }
+}
+
+[[nodiscard]] bool distributed::Coordinator::start(const std::string& address, const int& spawn, const std::string& executable) {
+    // Only this machine can connect unless a host says otherwise, every worker gets the scene
+    const std::size_t colon = address.rfind(':');
+    const std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    const std::string port_text = colon == std::string::npos ? address : address.substr(colon + 1);
+    char* end;
+    const long port = port_text.empty() ? 0 : std::strtol(port_text.c_str(), &end, 10);
+    sockaddr_in bound = {};
+    bound.sin_family = AF_INET;
+    if ((!port_text.empty() && *end != '\0') || port < 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &bound.sin_addr) != 1) {
+        std::cerr << "Error: Expected --coordinate [HOST:]PORT (HOST an IPv4 address), got {" << address << "}\n";
+        return false;
+    }
+    bound.sin_port = htons(static_cast<std::uint16_t>(port));
+
+    // A worker going away shows up as a failed send, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd >= 0) configure(_fd, true);
+    int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    socklen_t length = sizeof(bound);
+    if (_fd < 0 || bind(_fd, reinterpret_cast<sockaddr*>(&bound), sizeof(bound)) != 0 || listen(_fd, 64) != 0
+        || getsockname(_fd, reinterpret_cast<sockaddr*>(&bound), &length) != 0) {
+        std::cerr << "Error: Couldnt listen on " << host << ":" << port << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    const int listening = ntohs(bound.sin_port);
+    std::cout << "Coordinator: listening on " << host << ":" << listening << "\n";
+
+    // Local workers share the cores. Their output would mix with ours, only errors get through.
+    // Listening on every address includes loopback, any other host is one of ours too
+    const std::string worker_address = (host == "0.0.0.0" ? "127.0.0.1" : host) + ":" + std::to_string(listening);
+    const std::string threads = std::to_string(std::max(1u, std::thread::hardware_concurrency() / std::max(1, spawn)));
+    for (int i = 0; i < spawn; i++) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Error: Couldnt start a local worker: " << std::strerror(errno) << "\n";
+            return false;
+        }
+
+        if (pid == 0) {
+            const int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, STDOUT_FILENO);
+            execlp(executable.c_str(), executable.c_str(), "--worker", worker_address.c_str(), "--threads", threads.c_str(), static_cast<char*>(nullptr));
+            std::perror("Error: Couldnt start a local worker");
+            _exit(127);
+        }
+        _spawned.push_back(pid);
+    }
+
+    return true;
+}
+
+[[nodiscard]] std::unique_ptr<distributed::Connection> distributed::Coordinator::accept(const float& timeout) {
+    const int fd = ::accept(_fd, nullptr, nullptr);
+    if (fd < 0) return nullptr;
+
+    configure(fd, true);
+    no_delay(fd);
+    return std::make_unique<Connection>(fd, timeout);
+}
+
+////// CONNECT //////
+[[nodiscard]] std::unique_ptr<distributed::Connection> distributed::connect(const std::string& address, const float& timeout) {
+    int fd = -1;
+    if (address.find('/') != std::string::npos) {
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        if (address.size() < sizeof(local.sun_path)) {
+            std::memcpy(local.sun_path, address.c_str(), address.size());
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    } else {
+        const std::size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Error: Expected HOST:PORT or the path of a socket, got {" << address << "}\n";
+            return nullptr;
+        }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &found) == 0) {
+            for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+                fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(found);
+        }
+        if (fd >= 0) no_delay(fd);
+    }
+    if (fd < 0) {
+        std::cerr << "Error: Couldnt connect to {" << address << "}\n";
+        return nullptr;
+    }
+
+    configure(fd, false);
+    return std::make_unique<Connection>(fd, timeout);
+}
+
+////// WORKER //////
+[[nodiscard]] int distributed::work(const std::string& address, const std::vector<std::pair<std::string, std::string>>& settings) {
+    signal(SIGPIPE, SIG_IGN);
+    const std::unique_ptr<Connection> connected_to = connect(address, -1);
+    if (!connected_to) return EXIT_FAILURE;
+    Connection& connection = *connected_to;
+    std::cout << "Worker: connected to " << address << "\n";
+    if (!connection.send(MessageType::HELLO, 0, &PROTOCOL_VERSION, sizeof(PROTOCOL_VERSION))) {
+        std::cerr << "Error: Lost the coordinator\n";
+        return EXIT_FAILURE;
+    }
+
+    Scene scene;
+    RayTracingManager* renderer = nullptr;
+    int tiles_done = 0;
+    auto fail = [&](const std::string& why) {
+        std::cerr << "Error: " << why << "\n";
+        delete renderer;
+        return EXIT_FAILURE;
+    };
+
+    // A coordinator that has all its tiles closes the connection, even on workers still busy with a backup tile
+    auto lost = [&]() {
+        std::cout << "Worker: coordinator closed the connection after " << tiles_done << " tiles\n";
+        delete renderer;
+        return EXIT_FAILURE;
+    };
+
+    MessageHeader header;
+    std::string payload;
+    bool connected = true;
+    while (true) {
+        // What arrived before the connection closed still counts
+        while (!connection.next(header, payload)) {
+            if (!connected) return lost();
+            connected = connection.receive();
+        }
+
+        if (header.type == MessageType::SCENE) {
+            delete renderer;
+            renderer = nullptr;
+            if (!Scene::from_binary(payload, scene)) return fail("Got a scene that doesnt load");
+            for (auto& [key, value] : settings)
+                if (!scene.set(key, value)) return EXIT_FAILURE;
+            renderer = new RayTracingManager(scene.spheres(), scene.lights(), scene.camera, scene.settings, scene.meshes());
+        } else if (header.type == MessageType::TILE && renderer && payload.size() == sizeof(Tile)) {
+            Tile tile;
+            std::memcpy(&tile, payload.data(), sizeof(tile));
+            const T_COLOR colors = renderer->render_region(tile);
+
+            std::string pixels(sizeof(tile) + colors.size() * sizeof(Color), '\0');
+            std::memcpy(pixels.data(), &tile, sizeof(tile));
+            std::memcpy(pixels.data() + sizeof(tile), colors.data(), colors.size() * sizeof(Color));
+            if (!connection.send(MessageType::PIXELS, header.tile, pixels.data(), pixels.size())) return lost();
+            tiles_done++;
+        } else if (header.type == MessageType::DONE) {
+            break;
+        } else {
+            return fail("Unexpected message from the coordinator");
+        }
+    }
+
+    std::cout << "Worker: rendered " << tiles_done << " tiles\n";
+    delete renderer;
+    return EXIT_SUCCESS;
+}
+
+////// RENDER //////
+// Workers get at most TILES_IN_FLIGHT tiles at a time, so the next one is already there when they finish one.
+// * A worker that disconnects, sends garbage or doesnt finish a tile within worker_timeout gets dropped,
+//   its tiles go back to the front of the queue
+// * Once the queue is empty, idle workers also take a copy of the tiles of workers that are taking more
+//   than twice as long as the average tile (backup tiles), whichever copy comes back first is used
+// * Workers can join at any time. With no worker at all for worker_timeout the rest is rendered here
+[[nodiscard]] T_COLOR RayTracingManager::render_distributed(distributed::Coordinator& coordinator) const {
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t TILES_IN_FLIGHT = 2;
+    auto seconds = [](const clock::duration& duration) { return std::chrono::duration<double>(duration).count(); };
+
+    if (_settings.adaptive_sampling) std::cerr << "Warning: Distributed renders use SSAA, adaptive sampling is ignored\n";
+
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int width  = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    T_COLOR colors(width, height);
+
+    const std::vector<Tile> tiles = TileScheduler::split(width, height, _settings.remote_tile_size);
+    std::deque<int> pending(tiles.size());
+    std::iota(pending.begin(), pending.end(), 0);
+    std::vector<char> done(tiles.size(), 0);
+    std::vector<int> holders(tiles.size(), 0);  // Workers that have the tile right now
+    int tiles_done = 0, tiles_received = 0;
+    double tile_seconds = 0;                    // Of every received tile, for the average
+
+    struct Worker {
+        std::unique_ptr<distributed::Connection> connection;  // nullptr once dropped
+        bool ready = false;                     // Said hello and got the scene
+        std::vector<int> tiles;                 // In flight, in the order they were sent
+        clock::time_point last_heard;           // Last finished tile, or when it got work while idle
+        int tiles_done = 0;
+    };
+    std::vector<Worker> workers;
+    auto last_alive = clock::now();
+
+    auto drop = [&](Worker& worker, const std::string& why) {
+        std::cerr << "Warning: Dropped worker " << &worker - workers.data() << " (" << why << ") with " << worker.tiles.size() << " tiles\n";
+        for (int t : worker.tiles)
+            if (--holders[t] == 0 && !done[t]) pending.push_front(t);
+        worker.tiles.clear();
+        worker.connection.reset();
+    };
+
+    auto next_tile = [&](const Worker& worker, const clock::time_point& now) {
+        while (!pending.empty()) {
+            const int t = pending.front();
+            pending.pop_front();
+            if (!done[t]) return t;
+        }
+
+        // Queue is empty, back up the tile of the slowest worker if it is well behind
+        int backup = -1;
+        double slowest = tiles_received ? 2 * tile_seconds / tiles_received : std::numeric_limits<double>::max();
+        for (const Worker& other : workers) {
+            if (!other.connection || &other == &worker || seconds(now - other.last_heard) <= slowest) continue;
+            for (int t : other.tiles) {
+                if (done[t] || holders[t] > 1) continue;
+                backup = t;
+                slowest = seconds(now - other.last_heard);
+                break;
+            }
+        }
+        return backup;
+    };
+
+    auto receive = [&](Worker& worker, const distributed::MessageHeader& header, const std::string& payload, const clock::time_point& now) {
+        if (header.type == distributed::MessageType::HELLO) {
+            std::uint32_t version = 0;
+            if (payload.size() == sizeof(version)) std::memcpy(&version, payload.data(), sizeof(version));
+            if (version != distributed::PROTOCOL_VERSION) return drop(worker, "protocol version " + std::to_string(version));
+            if (!worker.connection->send(distributed::MessageType::SCENE, 0, coordinator.scene().data(), coordinator.scene().size()))
+                return drop(worker, "couldnt send the scene");
+            worker.ready = true;
+            return;
+        }
+
+        auto held = std::find(worker.tiles.begin(), worker.tiles.end(), static_cast<int>(header.tile));
+        if (header.type != distributed::MessageType::PIXELS || held == worker.tiles.end()) return drop(worker, "unexpected message");
+
+        const int t = *held;
+        const Tile& tile = tiles[t];
+        const std::size_t tile_width = tile.x1 - tile.x0;
+        Tile received;
+        if (payload.size() != sizeof(Tile) + tile_width * (tile.y1 - tile.y0) * sizeof(Color)) return drop(worker, "bad tile size");
+        std::memcpy(&received, payload.data(), sizeof(received));
+        if (received.x0 != tile.x0 || received.y0 != tile.y0 || received.x1 != tile.x1 || received.y1 != tile.y1) return drop(worker, "wrong tile");
+
+        worker.tiles.erase(held);
+        holders[t]--;
+        tile_seconds += seconds(now - worker.last_heard);
+        tiles_received++;
+        worker.last_heard = now;
+        if (done[t]) return;                    // The other copy of a backup tile was faster
+
+        const char* pixels = payload.data() + sizeof(Tile);
+        for (int y = tile.y0; y < tile.y1; y++)
+            std::memcpy(&colors.at(tile.x0, y), pixels + (y - tile.y0) * tile_width * sizeof(Color), tile_width * sizeof(Color));
+
+        done[t] = 1;
+        worker.tiles_done++;
+        utils::progress_bar("Rendering scene", ++tiles_done, tiles.size(), 50);
+    };
+
+    while (tiles_done < static_cast<int>(tiles.size())) {
+        auto now = clock::now();
+
+        ////// CONNECT //////
+        while (auto connection = coordinator.accept(_settings.worker_timeout))
+            workers.push_back({ std::move(connection), false, {}, now, 0 });
+
+        ////// TIMEOUTS //////
+        for (Worker& worker : workers)
+            if (worker.connection && !worker.tiles.empty() && seconds(now - worker.last_heard) > _settings.worker_timeout)
+                drop(worker, "timed out");
+
+        ////// ASSIGN //////
+        for (Worker& worker : workers) {
+            while (worker.connection && worker.ready && worker.tiles.size() < TILES_IN_FLIGHT) {
+                const int t = next_tile(worker, now);
+                if (t < 0) break;
+
+                if (worker.tiles.empty()) worker.last_heard = now;
+                worker.tiles.push_back(t);
+                holders[t]++;
+                if (!worker.connection->send(distributed::MessageType::TILE, t, &tiles[t], sizeof(Tile))) drop(worker, "connection lost");
+            }
+        }
+
+        ////// WAIT //////
+        std::vector<pollfd> fds = { { coordinator.fd(), POLLIN, 0 } };
+        for (Worker& worker : workers) fds.push_back({ worker.connection ? worker.connection->fd() : -1, POLLIN, 0 });
+        poll(fds.data(), fds.size(), 100);
+        now = clock::now();
+
+        ////// RECEIVE //////
+        for (std::size_t w = 0; w < workers.size(); w++) {
+            Worker& worker = workers[w];
+            if (!worker.connection || !fds[w + 1].revents) continue;
+
+            // What arrived before a disconnect still counts
+            const bool connected = worker.connection->receive();
+            distributed::MessageHeader header;
+            std::string payload;
+            while (worker.connection && worker.connection->next(header, payload)) receive(worker, header, payload, now);
+            if (!connected && worker.connection) drop(worker, "disconnected");
+        }
+
+        ////// NOBODY LEFT //////
+        if (std::any_of(workers.begin(), workers.end(), [](const Worker& worker) { return worker.connection != nullptr; })) {
+            last_alive = now;
+        } else if (seconds(now - last_alive) > _settings.worker_timeout) {
+            std::cerr << "Warning: No workers for " << _settings.worker_timeout << " s, rendering the remaining tiles here\n";
+            for (std::size_t t = 0; t < tiles.size(); t++) {
+                if (done[t]) continue;
+                const T_COLOR region = render_region(tiles[t]);
+                for (int y = tiles[t].y0; y < tiles[t].y1; y++)
+                    for (int x = tiles[t].x0; x < tiles[t].x1; x++)
+                        colors.at(x, y) = region.at(x - tiles[t].x0, y - tiles[t].y0);
+                done[t] = 1;
+                tiles_done++;
+            }
+        }
+    }
+
+    std::cout << "Distributed: " << tiles.size() << " tiles from " << workers.size() << " workers (";
+    for (std::size_t w = 0; w < workers.size(); w++) {
+        std::cout << (w ? ", " : "") << workers[w].tiles_done;
+        if (workers[w].connection) {
+            if (!workers[w].connection->send(distributed::MessageType::DONE, 0))
+                std::cerr << "Warning: Couldnt tell worker " << w << " it is done\n";
+        }
+    }
+    std::cout << ")\n";
+
+    return colors;
+}
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <raylib.h>
+#include <string>
+#include <vector>
+#include "image_writer.hpp"
+#include "utils.hpp"
+
+namespace {
+    // ExportImage encodes on the CPU (stb_image_write), it doesnt need a window
+    bool write_png(const T_COLOR& colors, const std::string& path) {
+        if (colors.layout() != FramebufferLayout::ROW_MAJOR) return false;
+
+        Image image;
+        image.data = const_cast<Color*>(colors.data());
+        image.width = colors.width();
+        image.height = colors.height();
+        image.mipmaps = 1;
+        image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+        return ExportImage(image, path.c_str());
+    }
+
+    ////// PNG //////
+    // https://www.w3.org/TR/png/ and https://www.rfc-editor.org/rfc/rfc1950 (zlib), big endian
+    void put_be32(std::string& out, const std::uint32_t& value) {
+        for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xFF);
+    }
+
+    constexpr std::array<std::uint32_t, 256> CRC_TABLE = [] {
+        std::array<std::uint32_t, 256> table;
+        for (std::uint32_t n = 0; n < 256; n++) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    std::uint32_t crc32(const std::string& data, std::uint32_t crc = 0xFFFFFFFFu) {
+        for (unsigned char byte : data) crc = CRC_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+    // Sums over at most 5552 bytes cant overflow before the modulo
+    std::uint32_t adler32(const std::string& data, const std::uint32_t& adler) {
+        std::uint32_t a = adler & 0xFFFF, b = adler >> 16;
+        for (std::size_t i = 0; i < data.size();) {
+            const std::size_t end = std::min(data.size(), i + 5552);
+            for (; i < end; i++) {
+                a += static_cast<unsigned char>(data[i]);
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    ////// EXR //////
+    // https://openexr.com/en/latest/OpenEXRFileLayout.html
+    // Everything is little endian
+    template <typename T>
+    void put(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void put_attribute(std::ofstream& file, const std::string& name, const std::string& type, const std::int32_t& size) {
+        file.write(name.c_str(), name.size() + 1);
+        file.write(type.c_str(), type.size() + 1);
+        put(file, size);
+    }
+
+    // One scanline per block, so the offsets are known before any pixel is
+    void put_exr_header(std::ofstream& file, const std::int32_t& width, const std::int32_t& height) {
+        const char channels[3] = {'B', 'G', 'R'};    // Have to be sorted by name
+
+        put<std::uint32_t>(file, 20000630);         // Magic number
+        put<std::uint32_t>(file, 2);                // Version 2, single part scanline
+
+        put_attribute(file, "channels", "chlist", 3 * 18 + 1);
+        for (char channel : channels) {
+            file.put(channel); file.put('\0');
+            put<std::int32_t>(file, 2);             // FLOAT
+            put<std::uint32_t>(file, 0);            // pLinear + reserved
+            put<std::int32_t>(file, 1);             // x sampling
+            put<std::int32_t>(file, 1);             // y sampling
+        }
+        file.put('\0');
+
+        put_attribute(file, "compression", "compression", 1); file.put(0);   // NO_COMPRESSION
+        put_attribute(file, "dataWindow", "box2i", 16);
+        put(file, 0); put(file, 0); put(file, width - 1); put(file, height - 1);
+        put_attribute(file, "displayWindow", "box2i", 16);
+        put(file, 0); put(file, 0); put(file, width - 1); put(file, height - 1);
+        put_attribute(file, "lineOrder", "lineOrder", 1); file.put(0);       // INCREASING_Y
+        put_attribute(file, "pixelAspectRatio", "float", 4); put(file, 1.0f);
+        put_attribute(file, "screenWindowCenter", "v2f", 8); put(file, 0.0f); put(file, 0.0f);
+        put_attribute(file, "screenWindowWidth", "float", 4); put(file, 1.0f);
+        file.put('\0');
+
+        const std::int32_t line_size = 3 * width * sizeof(float);
+        const std::uint64_t table_end = static_cast<std::uint64_t>(file.tellp()) + 8 * height;
+        for (std::int32_t y = 0; y < height; y++)
+            put<std::uint64_t>(file, table_end + static_cast<std::uint64_t>(y) * (8 + line_size));
+    }
+}
+
+////// STREAMING //////
+[[nodiscard]] bool image::StreamWriter::open(const std::string& path, const int& width, const int& height) {
+    const std::string ext = image::extension(path);
+    if (ext == "ppm")      _format = Format::PPM;
+    else if (ext == "png") _format = Format::PNG;
+    else if (ext == "exr") _format = Format::EXR;
+    else {
+        std::cerr << "Error: Unknown image format {" << path << "}, use .png, .ppm or .exr\n";
+        return false;
+    }
+
+    _file.open(path, std::ios::binary);
+    _path = path;
+    _width = width;
+    _height = height;
+    _rows = 0;
+    _adler = 1;
+
+    if (_format == Format::PPM) {
+        _file << "P6\n" << width << " " << height << "\n255\n";
+    } else if (_format == Format::EXR) {
+        put_exr_header(_file, width, height);
+    } else {
+        _file.write("\x89PNG\r\n\x1a\n", 8);
+        std::string header;
+        put_be32(header, width);
+        put_be32(header, height);
+        header += std::string("\x08\x02\x00\x00\x00", 5);   // 8 bit RGB, deflate, no filters, not interlaced
+        png_chunk("IHDR", header);
+        png_chunk("IDAT", "\x78\x01");                       // zlib header, no dictionary
+    }
+
+    if (!_file) std::cerr << "Error: Couldnt write {" << path << "}\n";
+    return static_cast<bool>(_file);
+}
+
+[[nodiscard]] bool image::StreamWriter::write(const T_COLOR& band) {
+    if (band.width() != _width || _rows + band.height() > _height) {
+        std::cerr << "Error: Band doesnt fit the image {" << _path << "}\n";
+        return false;
+    }
+
+    if (_format == Format::PPM) {
+        std::vector<unsigned char> row(3 * _width);
+        for (int y = 0; y < band.height(); y++) {
+            for (int x = 0; x < _width; x++) {
+                const Color& c = band.at(x, y);
+                row[3 * x] = c.r; row[3 * x + 1] = c.g; row[3 * x + 2] = c.b;
+            }
+            _file.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+    } else if (_format == Format::EXR) {
+        const std::int32_t line_size = 3 * _width * sizeof(float);
+        std::vector<float> line(3 * _width);
+        for (int y = 0; y < band.height(); y++) {
+            for (int x = 0; x < _width; x++) {
+                const Color& c = band.at(x, y);
+                line[x] = c.b / 255.0f;
+                line[_width + x] = c.g / 255.0f;
+                line[2 * _width + x] = c.r / 255.0f;
+            }
+            put<std::int32_t>(_file, _rows + y);
+            put(_file, line_size);
+            _file.write(reinterpret_cast<const char*>(line.data()), line_size);
+        }
+    } else {
+        // Every row is filter type 0 (none) and RGB
+        std::string rows;
+        rows.reserve(static_cast<std::size_t>(band.height()) * (1 + 3 * _width));
+        for (int y = 0; y < band.height(); y++) {
+            rows += '\0';
+            for (int x = 0; x < _width; x++) {
+                const Color& c = band.at(x, y);
+                rows += static_cast<char>(c.r); rows += static_cast<char>(c.g); rows += static_cast<char>(c.b);
+            }
+        }
+        _adler = adler32(rows, _adler);
+
+        // Stored deflate blocks (at most 65535 bytes, never the last one), they start and end on a byte
+        std::string blocks;
+        for (std::size_t i = 0; i < rows.size(); i += 65535) {
+            const std::uint16_t length = static_cast<std::uint16_t>(std::min<std::size_t>(65535, rows.size() - i));
+            blocks += '\0';
+            blocks += static_cast<char>(length & 0xFF); blocks += static_cast<char>(length >> 8);
+            blocks += static_cast<char>(~length & 0xFF); blocks += static_cast<char>((~length >> 8) & 0xFF);
+            blocks.append(rows, i, length);
+        }
+        png_chunk("IDAT", blocks);
+    }
+
+    _rows += band.height();
+    if (!_file) std::cerr << "Error: Couldnt write {" << _path << "}\n";
+    return static_cast<bool>(_file);
+}
+
+[[nodiscard]] bool image::StreamWriter::close() {
+    if (_rows != _height) {
+        std::cerr << "Error: Only " << _rows << " of " << _height << " rows written to {" << _path << "}\n";
+        return false;
+    }
+
+    if (_format == Format::PNG) {
+        std::string end("\x01\x00\x00\xFF\xFF", 5);          // Empty last block
+        put_be32(end, _adler);
+        png_chunk("IDAT", end);
+        png_chunk("IEND", "");
+    }
+
+    _file.close();
+    if (!_file) std::cerr << "Error: Couldnt write {" << _path << "}\n";
+    return static_cast<bool>(_file);
+}
+
+void image::StreamWriter::png_chunk(const char type[4], const std::string& data) {
+    std::string chunk;
+    put_be32(chunk, data.size());
+    chunk.append(type, 4);
+    chunk += data;
+
+    std::string crc;
+    put_be32(crc, crc32(chunk.substr(4)) ^ 0xFFFFFFFFu);
+    _file.write(chunk.data(), chunk.size());
+    _file.write(crc.data(), crc.size());
+}
+
+////// SEQUENCES //////
+image::SequenceWriter::SequenceWriter(const int& queue_size) : _images(std::max(queue_size, 0) + 1) {
+    for (int i = 0; i < static_cast<int>(_images.size()); i++) _free.push_back(i);
+    if (queue_size > 0) _thread = std::thread(&SequenceWriter::run, this);
+}
+
+image::SequenceWriter::~SequenceWriter() {
+    (void)finish();
+}
+
+[[nodiscard]] T_COLOR& image::SequenceWriter::acquire() {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [&] { return !_free.empty(); });
+    _wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const int i = _free.front();
+    _free.pop_front();
+    return _images[i];
+}
+
+void image::SequenceWriter::submit(T_COLOR& image, const std::string& path) {
+    const int i = static_cast<int>(&image - _images.data());
+
+    if (!_thread.joinable()) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!write(image, path)) _failed = true;
+        _encode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        _free.push_back(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queued.emplace_back(i, path);
+    }
+    _changed.notify_all();
+}
+
+// Takes the queued images in order, the lock is only held to take one and to give it back
+void image::SequenceWriter::run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _changed.wait(lock, [&] { return _stop || !_queued.empty(); });
+        if (_queued.empty()) return;
+
+        auto [i, path] = std::move(_queued.front());
+        _queued.pop_front();
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        const bool written = write(_images[i], path);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        _encode_seconds += seconds;
+        _failed = _failed || !written;
+        _free.push_back(i);
+        _changed.notify_all();
+    }
+}
+
+[[nodiscard]] bool image::SequenceWriter::finish() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _changed.notify_all();
+        _thread.join();
+    }
+    return !_failed;
+}
+
+[[nodiscard]] bool image::SequenceWriter::failed() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed;
+}
+
+[[nodiscard]] std::string image::extension(const std::string& path) {
+    const std::size_t dot = path.find_last_of('.');
+    const std::size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && slash > dot)) return "";
+
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext;
+}
+
+[[nodiscard]] bool image::write(const T_COLOR& colors, const std::string& path) {
+    // PPM and EXR dont compress, so they are the streamed files with the whole image as one band
+    if (image::extension(path) != "png") {
+        StreamWriter writer;
+        return writer.open(path, colors.width(), colors.height()) && writer.write(colors) && writer.close();
+    }
+
+    const bool written = write_png(colors, path);
+    if (!written) std::cerr << "Error: Couldnt write {" << path << "}\n";
+    return written;
+}
+
+[[nodiscard]] bool image::resolve_path(const std::string& path, const OverwritePolicy& policy, std::string& resolved) {
+    resolved = path;
+    if (!utils::file_exists(path) || policy == OverwritePolicy::OVERWRITE) return true;
+
+    if (policy == OverwritePolicy::REFUSE) {
+        std::cerr << "Error: Path {" << path << "} already exists\n";
+        return false;
+    }
+
+    const std::string ext = image::extension(path);
+    const std::string stem = ext.empty() ? path : path.substr(0, path.size() - ext.size() - 1);
+    for (int i = 1; utils::file_exists(resolved); i++)
+        resolved = stem + "_" + std::to_string(i) + (ext.empty() ? "" : path.substr(stem.size()));
+
+    return true;
+}
+
+[[nodiscard]] std::string image::frame_path(const std::string& path, const int& frame) {
+    const std::string ext = image::extension(path);
+    const std::string stem = ext.empty() ? path : path.substr(0, path.size() - ext.size() - 1);
+
+    std::string number = std::to_string(frame);
+    if (number.size() < 4) number.insert(0, 4 - number.size(), '0');
+    return stem + "_" + number + path.substr(stem.size());
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <raylib.h>
+#include <vector>
+#include "image_writer.hpp"
+#include "interactive.hpp"
+#include "manager.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+////// FRAME BUDGET //////
+interactive::FrameBudget::FrameBudget(const float& target_fps) : _seconds(TRACING_SHARE / target_fps) {}
+
+// Halfway to the newest measurement, so a view that suddenly looks at the mirrors catches up within a few frames
+void interactive::FrameBudget::record(const std::size_t& pixels, const double& seconds) {
+    if (pixels == 0) return;
+    _seconds_per_pixel = (_seconds_per_pixel + seconds / pixels) / 2;
+}
+
+[[nodiscard]] std::size_t interactive::FrameBudget::pixels() const {
+    return static_cast<std::size_t>(_seconds / _seconds_per_pixel);
+}
+
+[[nodiscard]] int interactive::FrameBudget::scale(const int& width, const int& height) const {
+    const double needed = static_cast<double>(width) * height / std::max<std::size_t>(pixels(), 1);
+    return std::clamp(static_cast<int>(std::ceil(std::sqrt(needed))), 1, MAX_SCALE);
+}
+
+////// INTERACTIVE //////
+// WASD moves across the view, R and F up and down, shift is 4x faster and the mouse wheel zooms.
+// Returns whether the view changed
+[[nodiscard]] bool RayTracingManager::move_camera(const float& seconds) {
+    Vector3 direction = {0, 0, 0};
+    if (IsKeyDown(KEY_W)) direction.z -= 1;
+    if (IsKeyDown(KEY_S)) direction.z += 1;
+    if (IsKeyDown(KEY_A)) direction.x -= 1;
+    if (IsKeyDown(KEY_D)) direction.x += 1;
+    if (IsKeyDown(KEY_R)) direction.y += 1;
+    if (IsKeyDown(KEY_F)) direction.y -= 1;
+    const float wheel = GetMouseWheelMove();
+
+    const bool moving = direction.x != 0 || direction.y != 0 || direction.z != 0;
+    if (moving) {
+        const float speed = _settings.move_speed * (IsKeyDown(KEY_LEFT_SHIFT) ? 4 : 1);
+        _camera->position += speed * seconds * utils::normalize(direction);
+    }
+    if (wheel != 0) _camera->fov = std::clamp(_camera->fov * std::pow(0.9f, wheel), 0.05f, 3.0f);
+
+    return moving || wheel != 0;
+}
+
+// One sample through the middle of every scale x scale block of displayed pixels
+void RayTracingManager::trace_preview(const Tile& tile, T_COLOR& preview, const int& scale, const float& tan_half_fov) const {
+    const float width = _upsampled_width / _SSAA_factor, height = _upsampled_height / _SSAA_factor;
+    const int full_width = static_cast<int>(std::ceil(_upsampled_width)) / static_cast<int>(_SSAA_factor);
+    stats::Counters& counters = stats::local();
+
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, _y * scale * full_width + _x * scale, 0, _settings.sampler_mode);
+            const float x =  (2.0f * (_x + 0.5f) * scale / width  - 1) * tan_half_fov * _displayed_ratio;
+            const float y = -(2.0f * (_y + 0.5f) * scale / height - 1) * tan_half_fov;
+
+            counters.primary_rays++;
+            preview.at(_x, _y) = utils::vec_to_color(trace_primary({
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            }, sampler));
+        }
+    }
+}
+
+// Sample pass of every pixel of the tile, jittered, added to sums. The display gets the mean
+void RayTracingManager::trace_refinement(const Tile& tile, T_PIXEL& sums, T_COLOR& display, const int& pass, const float& tan_half_fov) const {
+    const float width = _upsampled_width / _SSAA_factor, height = _upsampled_height / _SSAA_factor;
+    const float weight = 1.0f / (pass + 1);
+    stats::Counters& counters = stats::local();
+
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, _y * sums.width() + _x, pass, _settings.sampler_mode);
+            const Vector2 jitter = sampler.pixel_offset();
+            const float x =  (2.0f * (_x + jitter.x) / width  - 1) * tan_half_fov * _displayed_ratio;
+            const float y = -(2.0f * (_y + jitter.y) / height - 1) * tan_half_fov;
+
+            counters.primary_rays++;
+            const Vector3 color = trace_primary({
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            }, sampler);
+
+            Vector3& sum = sums.at(_x, _y);
+            sum = pass == 0 ? color : sum + color;
+            display.at(_x, _y) = utils::vec_to_color(weight * sum);
+        }
+    }
+}
+
+void RayTracingManager::render_interactive() {
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int width  = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    const int max_passes = SSAA * SSAA;
+
+    std::string output_path;
+    if (!_settings.output_path.empty() && !image::resolve_path(_settings.output_path, _settings.overwrite, output_path))
+        std::exit(EXIT_FAILURE);
+    std::cout << "WASD moves, R/F up and down, shift is faster, the mouse wheel zooms"
+              << (output_path.empty() ? "" : ", P writes " + output_path) << "\n";
+
+    SetTraceLogLevel(LOG_WARNING);
+    InitWindow(_displayed_width, _displayed_height, "raytracer");
+    SetTargetFPS(static_cast<int>(_settings.target_fps));
+
+    T_COLOR display(width, height);
+    std::fill(display.data(), display.data() + display.size(), BLACK);
+    T_PIXEL sums(width, height);
+    T_COLOR preview;
+    Texture2D texture = form_texture(display);
+
+    interactive::FrameBudget budget(_settings.target_fps);
+    const std::vector<Tile> tiles = TileScheduler::split(width, height, _settings.tile_size);
+    const std::size_t tile_pixels = static_cast<std::size_t>(_settings.tile_size) * _settings.tile_size;
+    std::size_t next_tile = 0;
+    int pass = 0;
+    int preview_scale = 0;                  // 0 -> the texture holds display, otherwise the top left corner holds preview
+
+    // Traces the tiles on the scheduler and tells the budget how long they took
+    auto trace = [&](const std::vector<Tile>& batch, const std::size_t& pixels, auto tile_job) {
+        const auto timer = _stats->time(stats::Stage::TRACING);
+        const auto start = std::chrono::steady_clock::now();
+        _scheduler->run(batch, [&](const Tile& tile, const int& thread_id) {
+            const auto binding = _stats->bind(thread_id);
+            tile_job(tile);
+        });
+        budget.record(pixels, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    };
+
+    // The preview blown up into display, so the passes can replace it tile by tile
+    auto settle = [&]() {
+        if (!preview_scale) return;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                display.at(x, y) = preview.at(x / preview_scale, y / preview_scale);
+        preview_scale = 0;
+    };
+
+    bool changed = true;                    // The first frame has nothing to show yet
+    while (!WindowShouldClose()) {
+        changed = move_camera(GetFrameTime()) || changed;
+        const float tan_half_fov = std::tan(_camera->fov / 2.0f);
+
+        if (changed) {
+            preview_scale = budget.scale(width, height);
+            preview = T_COLOR((width + preview_scale - 1) / preview_scale, (height + preview_scale - 1) / preview_scale);
+            trace(TileScheduler::split(preview.width(), preview.height(), _settings.tile_size), preview.size(), [&](const Tile& tile) {
+                trace_preview(tile, preview, preview_scale, tan_half_fov);
+            });
+            UpdateTextureRec(texture, { 0, 0, static_cast<float>(preview.width()), static_cast<float>(preview.height()) }, preview.data());
+            next_tile = 0;
+            pass = 0;
+            changed = false;
+        } else if (pass < max_passes) {
+            settle();
+
+            // Every thread gets at least one tile, even when the budget says less
+            const std::size_t count = std::max<std::size_t>(budget.pixels() / tile_pixels, _scheduler->thread_count());
+            const std::vector<Tile> batch(tiles.begin() + next_tile, tiles.begin() + std::min(tiles.size(), next_tile + count));
+            std::size_t pixels = 0;
+            for (const Tile& tile : batch) pixels += static_cast<std::size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+            trace(batch, pixels, [&](const Tile& tile) {
+                trace_refinement(tile, sums, display, pass, tan_half_fov);
+            });
+            UpdateTexture(texture, display.data());
+
+            next_tile += batch.size();
+            if (next_tile == tiles.size()) {
+                next_tile = 0;
+                pass++;
+            }
+        }
+
+        if (IsKeyPressed(KEY_P) && !output_path.empty()) {
+            settle();
+            UpdateTexture(texture, display.data());
+            const auto timer = _stats->time(stats::Stage::ENCODE);
+            if (image::write(display, output_path)) std::cout << "Wrote " << output_path << "\n";
+        }
+
+        const Rectangle source = preview_scale
+            ? Rectangle{ 0, 0, static_cast<float>(preview.width()), static_cast<float>(preview.height()) }
+            : Rectangle{ 0, 0, static_cast<float>(width), static_cast<float>(height) };
+        const float scale = _pixel_spacing * std::max(preview_scale, 1);
+
+        BeginDrawing();
+            ClearBackground(BLACK);
+            DrawTexturePro(texture, source, { 0, 0, source.width * scale, source.height * scale }, { 0, 0 }, 0.0f, WHITE);
+            if (preview_scale) DrawText(TextFormat("%d fps, 1/%d resolution", GetFPS(), preview_scale), 10, 10, 20, GREEN);
+            else DrawText(TextFormat("%d fps, %d/%d samples", GetFPS(), std::min(pass + 1, max_passes), max_passes), 10, 10, 20, GREEN);
+        EndDrawing();
+    }
+
+    UnloadTexture(texture);
+    CloseWindow();
+    report_stats();
+}
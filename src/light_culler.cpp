@@ -0,0 +1,26 @@
+#include <vector>
+#include "light_culler.hpp"
+
+void LightCuller::build(std::span<const Light> lights) {
+    _lights = lights;
+    _global.clear();
+    _ranged.clear();
+
+    std::vector<AABB> bounds;
+    for (std::size_t l = 0; l < lights.size(); l++) {
+        const Light& light = lights[l];
+        if (light.range <= 0) {
+            _global.push_back(static_cast<int>(l));
+            continue;
+        }
+
+        _ranged.push_back(static_cast<int>(l));
+        bounds.push_back({
+            light.position - Vector3{light.range, light.range, light.range},
+            light.position + Vector3{light.range, light.range, light.range}
+        });
+    }
+
+    _bvh = BVH();
+    if (!bounds.empty()) _bvh.build(bounds);
+}
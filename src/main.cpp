@@ -1,12 +1,21 @@
+#include <algorithm>
 #include <cstdint>
+#include <utility>
+#include <cstdlib>
+#include <iostream>
 #include <vector>
+#include "animation.hpp"
+#include "distributed.hpp"
 #include "manager.hpp"
 #include "objects.hpp"
+#include "options.hpp"
+#include "scene.hpp"
+#include "server.hpp"
 #include "defines.hpp"
 
 
-// https://github.com/ssloy/tinyraytracer/wiki/Part-1:-understandable-raytracing
-int main() {
+// The scene that gets rendered without --scene. Same as scenes/default.scene
+Scene default_scene() {
     _Material mirror = {
         .albedo = {1, 1, 1},
         .ambient_reflection = 1,
@@ -37,13 +46,13 @@ int main() {
         .scattering_constant= 0
     };
 
-    const std::vector<Light> lights {
+    std::vector<Light> lights {
         {{-20, 20, 20}, 1.5, 1.5},      // A lil to the left
         {{30, 20, 30}, 1.7, 1.7},       // A lil to the right
         {{30, 50, -25}, 1.3, 1.3}       // Light high up
     };
 
-    const std::vector<Sphere> spheres = {
+    std::vector<Sphere> spheres = {
         {{-3.0, 0.0, -16.0  },          2,      light_metallic_brown    },
         {{-9.0, 6.0, -18.0  },          5,      light_metallic_brown    },
         {{-1.0, -1.5, -12.0 },          2,      dark_matt_brown         },
@@ -53,7 +62,103 @@ int main() {
         {{9, -7.5, -18.0    },          6,      scratched_mirror         },
     };
 
-    RayTracingManager* renderer = new RayTracingManager(spheres, lights);
-    renderer->render();
+    return Scene(std::move(spheres), std::move(lights));
+}
+
+// https://github.com/ssloy/tinyraytracer/wiki/Part-1:-understandable-raytracing
+int main(int argc, char** argv) {
+    CommandLine command_line;
+    int exit_code;
+    if (!parse_arguments(argc, argv, command_line, exit_code)) return exit_code;
+
+    // A worker gets its scene from the coordinator
+    if (!command_line.worker_address.empty()) return distributed::work(command_line.worker_address, command_line.settings);
+
+    // The render server gets them from its clients
+    if (!command_line.serve_address.empty()) return server::serve(command_line.serve_address, command_line.settings);
+
+    Scene scene;
+    if (command_line.scene_path.empty()) scene = default_scene();
+    else if (!Scene::load(command_line.scene_path, scene)) return EXIT_FAILURE;
+
+    for (auto& [key, value] : command_line.settings)
+        if (!scene.set(key, value)) return EXIT_FAILURE;
+
+    if (!command_line.save_scene_path.empty()) {
+        if (!scene.save_binary(command_line.save_scene_path)) return EXIT_FAILURE;
+        std::cout << "Saved " << command_line.save_scene_path << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    if (!command_line.client_address.empty()) {
+        if (command_line.interactive || !command_line.animation_path.empty() || !command_line.coordinate_address.empty() || command_line.spawn_workers > 0) {
+            std::cerr << "Error: --client renders one image on the server, not with --interactive, --animation or workers\n";
+            return EXIT_FAILURE;
+        }
+        return server::request(command_line.client_address, scene, command_line.region);
+    }
+    if (command_line.region.x1 > command_line.region.x0) {
+        std::cerr << "Error: --region only works with --client\n";
+        return EXIT_FAILURE;
+    }
+
+    if (scene.settings.headless && scene.settings.output_path.empty()) {
+        std::cerr << "Error: --headless needs --output\n";
+        return EXIT_FAILURE;
+    }
+
+    if (command_line.interactive) {
+        if (scene.settings.headless || !command_line.animation_path.empty() || !command_line.coordinate_address.empty() || command_line.spawn_workers > 0) {
+            std::cerr << "Error: --interactive needs the window and renders the scene itself, not with --headless, --animation or workers\n";
+            return EXIT_FAILURE;
+        }
+
+        RayTracingManager* renderer = new RayTracingManager(scene.spheres(), scene.lights(), scene.camera, scene.settings, scene.meshes());
+        renderer->render_interactive();
+        delete renderer;
+        return EXIT_SUCCESS;
+    }
+
+    // The frames move spheres and lights, so they get copied out of the (maybe mapped) scene
+    if (!command_line.animation_path.empty()) {
+        if (scene.settings.output_path.empty()) {
+            std::cerr << "Error: --animation needs --output\n";
+            return EXIT_FAILURE;
+        }
+        if (!command_line.coordinate_address.empty() || command_line.spawn_workers > 0) {
+            std::cerr << "Error: Animations cant be rendered distributed\n";
+            return EXIT_FAILURE;
+        }
+
+        std::vector<Sphere> spheres(scene.spheres().begin(), scene.spheres().end());
+        std::vector<Light> lights(scene.lights().begin(), scene.lights().end());
+        std::vector<animation::Frame> frames;
+        if (!animation::load(command_line.animation_path, spheres.size(), lights.size(), frames)) return EXIT_FAILURE;
+        if (command_line.first_frame >= static_cast<int>(frames.size())) {
+            std::cerr << "Error: --frames starts at " << command_line.first_frame << " but the animation has " << frames.size() << " frames\n";
+            return EXIT_FAILURE;
+        }
+        const int last_frame = command_line.last_frame < 0 ? static_cast<int>(frames.size()) - 1
+                                                           : std::min(command_line.last_frame, static_cast<int>(frames.size()) - 1);
+
+        RayTracingManager* renderer = new RayTracingManager(spheres, lights, scene.camera, scene.settings, scene.meshes());
+        renderer->render_animation(frames, spheres, lights, command_line.first_frame, last_frame);
+        delete renderer;
+        return EXIT_SUCCESS;
+    }
+
+    // Before the renderer, starting local workers forks and thats best done without threads around
+    distributed::Coordinator* coordinator = nullptr;
+    if (!command_line.coordinate_address.empty() || command_line.spawn_workers > 0) {
+        coordinator = new distributed::Coordinator(scene.to_binary());
+        if (!coordinator->start(command_line.coordinate_address, command_line.spawn_workers, argv[0])) {
+            delete coordinator;
+            return EXIT_FAILURE;
+        }
+    }
+
+    RayTracingManager* renderer = new RayTracingManager(scene.spheres(), scene.lights(), scene.camera, scene.settings, scene.meshes());
+    renderer->render(coordinator);
     delete renderer;
+    delete coordinator;
 }
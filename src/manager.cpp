@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <iostream>
 #include <raylib.h>
 #include <unistd.h>
 #include <cstddef>
@@ -9,116 +12,400 @@
 #include "camera.hpp"
 #include "objects.hpp"
 #include "defines.hpp"
+#include "footprint.hpp"
+#include "image_writer.hpp"
 #include "manager.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
-[[nodiscard]] T_PIXEL RayTracingManager::render_scene() const {
-    float x, y;
-
-    T_PIXEL pixels;
-    std::vector<Vector3> slice;
-    for (int _y = 0; _y < _upsampled_height; _y++) {
-        utils::progress_bar("Rendering scene", _y, _upsampled_height - 1, 50);
-        slice.clear();
-        for (int _x = 0; _x < _upsampled_width; _x++) {
-            x =  (2.0f * _x / _upsampled_width  - 1) * std::tan(_camera->fov / 2.0f) * _displayed_ratio;
-            y = -(2.0f * _y / _upsampled_height - 1) * std::tan(_camera->fov / 2.0f);
-
-            slice.push_back(cast_ray({
-                .position = _camera->position,
-                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
-            }, 0 ));
+[[nodiscard]] T_PIXEL RayTracingManager::render_scene(FeatureBuffer* features) const {
+    const int width  = static_cast<int>(std::ceil(_upsampled_width));
+    const int height = static_cast<int>(std::ceil(_upsampled_height));
+
+    T_PIXEL pixels(width, height, _settings.framebuffer_layout, _settings.tile_size);
+    if (features) *features = FeatureBuffer(width, height, _settings.framebuffer_layout, _settings.tile_size);
+
+    // Every upsampled pixel is one sample of the displayed pixel it gets averaged into
+    _stats->start_heatmap(width / static_cast<int>(_SSAA_factor), height / static_cast<int>(_SSAA_factor));
+    trace_tiles(TileScheduler::split(width, height, _settings.tile_size), pixels, {}, true, nullptr, {}, features);
+
+    return pixels;
+}
+
+// Only the upsampled pixels of the tile get allocated, as a window of the frame, so
+// the samples are exactly the ones render_scene takes for these pixels
+[[nodiscard]] T_PIXEL RayTracingManager::trace_region(const Tile& tile) const {
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int width = (tile.x1 - tile.x0) * SSAA, height = (tile.y1 - tile.y0) * SSAA;
+
+    T_PIXEL pixels(width, height, _settings.framebuffer_layout, _settings.tile_size, tile.x0 * SSAA, tile.y0 * SSAA);
+    _stats->start_heatmap(tile.x1 - tile.x0, tile.y1 - tile.y0, tile.x0, tile.y0);
+
+    std::vector<Tile> tiles = TileScheduler::split(width, height, _settings.tile_size);
+    for (Tile& t : tiles) t = { t.x0 + pixels.origin_x(), t.y0 + pixels.origin_y(), t.x1 + pixels.origin_x(), t.y1 + pixels.origin_y() };
+    trace_tiles(tiles, pixels, {}, false);
+
+    return pixels;
+}
+
+// A region is always part of something bigger, that shows the progress
+[[nodiscard]] T_COLOR RayTracingManager::render_region(const Tile& tile) const {
+    return utils::adjust_pixels(trace_region(tile), static_cast<int>(_SSAA_factor), false);
+}
+
+// Band by band straight into the file, so memory depends on the width and band_height only.
+// Same pixels as render_scene, the heatmap only ever holds the current band so it isnt written
+void RayTracingManager::render_streaming(const std::string& path) const {
+    if (_settings.adaptive_sampling) std::cerr << "Warning: Streamed renders use SSAA, adaptive sampling is ignored\n";
+
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int width  = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+
+    image::StreamWriter writer;
+    if (!writer.open(path, width, height)) std::exit(EXIT_FAILURE);
+
+    for (int y0 = 0; y0 < height; y0 += _settings.band_height) {
+        const Tile band = { 0, y0, width, std::min(height, y0 + _settings.band_height) };
+
+        T_PIXEL pixels;
+        {
+            const auto timer = _stats->time(stats::Stage::TRACING);
+            pixels = trace_region(band);
+        }
+        T_COLOR colors;
+        {
+            const auto timer = _stats->time(stats::Stage::RESOLVE);
+            colors = utils::adjust_pixels(pixels, SSAA, false);
         }
-        pixels.push_back(slice);
+        {
+            const auto timer = _stats->time(stats::Stage::ENCODE);
+            if (!writer.write(colors)) std::exit(EXIT_FAILURE);
+        }
+
+        utils::progress_bar("Rendering bands", band.y1, height, 50);
     }
 
-    return pixels;
+    if (!writer.close()) std::exit(EXIT_FAILURE);
+    std::cout << "Wrote " << path << "\n";
+}
+
+void RayTracingManager::trace_tiles(const std::vector<Tile>& tiles, T_PIXEL& pixels, const std::vector<TileFootprint*>& footprints, const bool& show_progress,
+                                    GBuffer* gbuffer, const std::vector<bool>& record_gbuffer, FeatureBuffer* features) const {
+    const float tan_half_fov = std::tan(_camera->fov / 2.0f);
+    std::atomic<int> tiles_done = 0;
+
+    _scheduler->run(tiles, [&](const Tile& tile, const int& thread_id) {
+        const auto binding = _stats->bind(thread_id);
+
+        TileFootprint* record = footprints.empty() ? nullptr : footprints[&tile - tiles.data()];
+        if (record) record->clear(_lights.size());
+        const footprint::Binding recording(record);
+
+        // The G-buffer and the features are filled by the recursive kernels only, so they win over the wavefront engine
+        if (gbuffer) {
+            shade_tile(tile, pixels, *gbuffer, record_gbuffer[&tile - tiles.data()], tan_half_fov, features);
+        } else if (features) {
+            feature_tile(tile, pixels, *features, tan_half_fov);
+        } else if (_wavefront) {
+            thread_local wavefront::Buffers buffers;
+            trace_wavefront(tile, buffers, pixels, tan_half_fov);
+        } else {
+            (this->*_tile_kernel)(tile, pixels, tan_half_fov);
+        }
+
+        if (record) record->finish();
+        if (show_progress) utils::progress_bar("Rendering scene", ++tiles_done, tiles.size(), 50);
+    });
+}
+
+// With the low discrepancy sampler every extra sub pixel sample lands in the biggest gap
+// left by the previous ones, so no sample is wasted when refining.
+[[nodiscard]] T_COLOR RayTracingManager::render_adaptive() const {
+    const int width  = static_cast<int>(_displayed_width / _pixel_spacing);
+    const int height = static_cast<int>(_displayed_height / _pixel_spacing);
+    const float tan_half_fov = std::tan(_camera->fov / 2.0f);
+
+    T_COLOR colors(width, height);
+
+    const std::vector<Tile> tiles = TileScheduler::split(width, height, _settings.tile_size);
+    std::atomic<int> tiles_done = 0;
+    std::atomic<long> samples_taken = 0;
+    _stats->start_heatmap(width, height);
+
+    struct PixelEstimate {
+        Vector3 color_sum;
+        float luminance_sum;
+        float luminance_sum2;
+        int samples;
+
+        [[nodiscard]] float mean() const { return luminance_sum / samples; }
+        [[nodiscard]] float error() const {
+            float variance = std::max(0.0f, luminance_sum2 / samples - mean() * mean());
+            return std::sqrt(variance / samples);
+        }
+    };
+
+    _scheduler->run(tiles, [&](const Tile& tile, const int& thread_id) {
+        const auto binding = _stats->bind(thread_id);
+        stats::Counters& counters = stats::local();
+
+        const int tile_width = tile.x1 - tile.x0;
+        thread_local std::vector<PixelEstimate> estimates;
+        thread_local std::vector<char> refine;
+        estimates.assign(tile_width * (tile.y1 - tile.y0), {{0, 0, 0}, 0, 0, 0});
+        refine.assign(estimates.size(), 0);
+
+        auto take_samples = [&](const int& px, const int& py, const int& count) {
+            PixelEstimate& e = estimates[(py - tile.y0) * tile_width + px - tile.x0];
+            const std::uint64_t cost = counters.cost();
+            counters.primary_rays += count;
+
+            for (int i = 0; i < count; i++, e.samples++) {
+                const Sampler sampler(_settings.seed, py * width + px, e.samples, _settings.sampler_mode);
+                const Vector2 offset = sampler.pixel_offset();
+
+                float x =  (2.0f * (px + offset.x) / width  - 1) * tan_half_fov * _displayed_ratio;
+                float y = -(2.0f * (py + offset.y) / height - 1) * tan_half_fov;
+
+                Vector3 color = trace_primary({
+                    .position = _camera->position,
+                    .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+                }, sampler);
+
+                float luminance = 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+                e.color_sum += color;
+                e.luminance_sum += luminance;
+                e.luminance_sum2 += luminance * luminance;
+            }
+
+            _stats->add_cost(px, py, counters.cost() - cost);
+        };
+
+        // First pass: a few samples everywhere
+        for (int py = tile.y0; py < tile.y1; py++)
+            for (int px = tile.x0; px < tile.x1; px++)
+                take_samples(px, py, _settings.adaptive_min_samples);
+
+        // Second pass: find the pixels that are noisy or stand out from their neighbours
+        for (int py = tile.y0; py < tile.y1; py++) {
+            for (int px = tile.x0; px < tile.x1; px++) {
+                const int i = (py - tile.y0) * tile_width + px - tile.x0;
+                const float mean = estimates[i].mean();
+                bool noisy = estimates[i].error() > _settings.adaptive_threshold;
+
+                if (px > tile.x0)     noisy |= std::abs(mean - estimates[i - 1].mean()) > _settings.adaptive_threshold;
+                if (px < tile.x1 - 1) noisy |= std::abs(mean - estimates[i + 1].mean()) > _settings.adaptive_threshold;
+                if (py > tile.y0)     noisy |= std::abs(mean - estimates[i - tile_width].mean()) > _settings.adaptive_threshold;
+                if (py < tile.y1 - 1) noisy |= std::abs(mean - estimates[i + tile_width].mean()) > _settings.adaptive_threshold;
+
+                refine[i] = noisy;
+            }
+        }
+
+        // Last pass: keep refining until the estimate is good enough or the max is hit
+        long tile_samples = 0;
+        for (int py = tile.y0; py < tile.y1; py++) {
+            for (int px = tile.x0; px < tile.x1; px++) {
+                const int i = (py - tile.y0) * tile_width + px - tile.x0;
+                PixelEstimate& e = estimates[i];
+
+                if (refine[i]) {
+                    // A flagged pixel always gets one more batch, then more while it is still noisy
+                    take_samples(px, py, std::min(_settings.adaptive_min_samples, _settings.adaptive_max_samples - e.samples));
+                    while (e.samples < _settings.adaptive_max_samples && e.error() > _settings.adaptive_threshold)
+                        take_samples(px, py, std::min(_settings.adaptive_min_samples, _settings.adaptive_max_samples - e.samples));
+                }
+
+                tile_samples += e.samples;
+                colors.at(px, py) = utils::vec_to_color((1.0f / e.samples) * e.color_sum);
+            }
+        }
+
+        samples_taken += tile_samples;
+        utils::progress_bar("Rendering scene", ++tiles_done, tiles.size(), 50);
+    });
+
+    std::cout << "Adaptive sampling: " << std::setprecision(2)
+              << static_cast<double>(samples_taken) / (static_cast<double>(width) * height) << " samples per pixel\n";
+
+    return colors;
 }
 
-[[nodiscard]] RenderTexture2D RayTracingManager::form_texture(T_COLOR colors, int width, int height) const {
+// The image gets uploaded once and scaled up by _pixel_spacing when drawn.
+// (Textures loaded from an image arent Y flipped, only render textures are)
+[[nodiscard]] Texture2D RayTracingManager::form_texture(const T_COLOR& colors) const {
     Image image;
-    image.data = colors.data();
-    image.width = static_cast<int>(width);
-    image.height = static_cast<int>(height);
+    image.data = const_cast<Color*>(colors.data());
+    image.width = colors.width();
+    image.height = colors.height();
     image.mipmaps = 1;
     image.format =  PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
 
-    Texture2D texture = LoadTextureFromImage(image);
-    RenderTexture2D target = LoadRenderTexture(texture.width * _pixel_spacing, texture.height * _pixel_spacing);
+    return LoadTextureFromImage(image);
+}
 
-    BeginTextureMode(target);
-        ClearBackground(BLACK);
-        DrawTextureEx(texture, {0, 0}, 0.0f, _pixel_spacing, WHITE);
-    EndTextureMode();
+void RayTracingManager::render(distributed::Coordinator* coordinator) {
+    // Refuse before spending minutes on the render
+    std::string output_path;
+    if (!_settings.output_path.empty() && !image::resolve_path(_settings.output_path, _settings.overwrite, output_path))
+        std::exit(EXIT_FAILURE);
 
-    // https://www.reddit.com/r/raylib/comments/14lk8fx/texture_is_rendering_coordinates_with_flipped_y/
-    // Basically, the texture is mirrored because of opengls origo being in the bottom left
-    // The solution is that I render the texture once more with a normal DrawTextureV,
-    // and bada bing bada boom, it works. But thats becuase were basically flipping the image upsidedown twice...
-    RenderTexture2D target_unflipped = LoadRenderTexture(target.texture.width, target.texture.height);
+    if (_denoiser && (coordinator || _settings.adaptive_sampling || _settings.band_height > 0))
+        std::cerr << "Warning: Denoising needs every sample of the frame at once, streamed, adaptive and distributed renders arent denoised\n";
 
-    BeginTextureMode(target_unflipped);
-        ClearBackground(BLACK);
-        DrawTextureV(target.texture, {0, 0}, WHITE);
-    EndTextureMode();
+    if (_settings.band_height > 0 && coordinator)
+        std::cerr << "Warning: Distributed renders are resolved in memory, band_height is ignored\n";
 
-    // Cleanup
-    UnloadTexture(texture);
-    UnloadRenderTexture(target);
+    if (_settings.band_height > 0 && !coordinator) {
+        if (output_path.empty()) {
+            std::cerr << "Error: band_height needs --output, a streamed image is never whole in memory\n";
+            std::exit(EXIT_FAILURE);
+        }
+        if (!_settings.headless) std::cout << "Streamed renders only go to the file, no window\n";
+        render_streaming(output_path);
+        report_stats();
+        return;
+    }
 
-    return target_unflipped;
-}
+    // The upsampled pixels are freed as soon as they are resolved
+    T_COLOR colors;
+    if (coordinator) {
+        const auto timer = _stats->time(stats::Stage::TRACING);
+        colors = render_distributed(*coordinator);
+    } else if (_settings.adaptive_sampling) {
+        const auto timer = _stats->time(stats::Stage::TRACING);
+        colors = render_adaptive();
+    } else {
+        T_PIXEL pixels;
+        FeatureBuffer features;
+        {
+            const auto timer = _stats->time(stats::Stage::TRACING);
+            pixels = render_scene(_denoiser ? &features : nullptr);
+        }
+        if (_denoiser) {
+            const auto timer = _stats->time(stats::Stage::DENOISE);
+            _denoiser->filter(pixels, features, pixels, *_scheduler);
+        }
+        const auto timer = _stats->time(stats::Stage::RESOLVE);
+        colors = utils::adjust_pixels(pixels, _SSAA_factor);
+    }
 
-void RayTracingManager::check_image(const std::string PATH) const {
-    if (utils::file_exists(PATH)) {
-        std::cerr << "Error: Path {" << PATH << "} already exists\n";
-        std::exit(0);
+    if (!output_path.empty()) {
+        const auto timer = _stats->time(stats::Stage::ENCODE);
+        if (image::write(colors, output_path)) std::cout << "Wrote " << output_path << "\n";
     }
-}
 
-void RayTracingManager::render() {
-    if (_write_file) check_image(_FILE_PATH);
+    // The work of a distributed render happens in the workers, it has no heatmap
+    std::string heatmap_path;
+    if (!_settings.heatmap_path.empty() && !coordinator && image::resolve_path(_settings.heatmap_path, _settings.overwrite, heatmap_path)
+        && image::write(_stats->heatmap_image(), heatmap_path))
+        std::cout << "Wrote " << heatmap_path << "\n";
 
-    T_PIXEL pixels = render_scene();
-    T_COLOR colors = utils::adjust_pixels(pixels, _SSAA_factor);
+    // Headless: no window, no GL context
+    if (_settings.headless) {
+        report_stats();
+        return;
+    }
 
     SetTraceLogLevel(LOG_WARNING);
     InitWindow(_displayed_width, _displayed_height, "raytracer");
     SetTargetFPS(60);
 
-    Texture2D rendered_scene = form_texture(colors, pixels.front().size() / _SSAA_factor, pixels.size() / _SSAA_factor).texture;
-    if (_write_file) {
-        Image image = LoadImageFromTexture(rendered_scene);
-        ExportImage(image, _FILE_PATH.c_str());
-        UnloadImage(image);
+    Texture2D rendered_scene;
+    {
+        const auto timer = _stats->time(stats::Stage::DISPLAY);
+        rendered_scene = form_texture(colors);
     }
+    report_stats();
 
     while (!WindowShouldClose()) {
         BeginDrawing();
             ClearBackground(BLACK);
-            DrawTextureV(rendered_scene, {0, 0}, WHITE);
+            DrawTextureEx(rendered_scene, {0, 0}, 0.0f, _pixel_spacing, WHITE);
         EndDrawing();
     }
 
     UnloadTexture(rendered_scene);
+    CloseWindow();
+}
+
+void RayTracingManager::report_stats() const {
+    if (_settings.print_stats) {
+        std::cout << "Kernel: " << _kernel_name << "\n";
+        _stats->print_summary(std::cout);
+    }
+    if (!_settings.stats_path.empty() && _stats->write_json(_settings.stats_path))
+        std::cout << "Wrote " << _settings.stats_path << "\n";
 }
 
 RayTracingManager::RayTracingManager(
-    const std::vector<Sphere>& sphs,
-    const std::vector<Light>& lhts
-) : _spheres(sphs), _lights(lhts)  {
-    _camera = new _Camera {
-        .position = {0, 0, 0},
-        .focal_length = 0.6,
-        .fov = PI / 2,
-        .render_distance = 30,
-        .scene_lighting = 1,
-        .max_reflection_depth = 5
-    };
+    std::span<const Sphere> sphs,
+    std::span<const Light> lhts,
+    const _Camera& camera,
+    const RenderSettings& settings,
+    const MeshView& meshes,
+    TileScheduler* scheduler
+) : _spheres(sphs), _lights(lhts), _settings(settings)  {
+    _camera = new _Camera(camera);
+
+    _owns_scheduler = !scheduler;
+    _scheduler = scheduler ? scheduler : new TileScheduler(_settings.thread_count);
+    _stats = new RenderStats(_scheduler->thread_count());
+    if (_settings.denoise) _denoiser = new Denoiser(_settings.denoise_passes, _settings.denoise_strength);
+
+    build_acceleration();
+    build_lights();
+    if (!meshes.instances.empty()) {
+        const auto timer = _stats->time(stats::Stage::SCENE_SETUP);
+        _mesh_scene.build(meshes);
+    }
+    select_kernels();
+
+    // The wavefront engine only knows spheres and shades every light
+    _wavefront = _settings.engine == RenderEngine::WAVEFRONT;
+    if (_wavefront && (_many_lights || !_mesh_scene.empty())) {
+        std::cerr << "Warning: The wavefront engine doesnt do meshes, light ranges or light_samples, using the recursive one\n";
+        _wavefront = false;
+    }
+}
+
+// BVH and sphere store, again whenever spheres move
+void RayTracingManager::build_acceleration() {
+    if (!_settings.use_bvh) return;
+
+    const auto timer = _stats->time(stats::Stage::SCENE_SETUP);
+    std::vector<AABB> bounds;
+    bounds.reserve(_spheres.size());
+    for (auto& sphere : _spheres) bounds.push_back(sphere.bounds());
+
+    // A leaf fills (at most) one SIMD vector
+    _bvh.build(bounds, std::max(4, _sphere_store.lane_count()));
+    _sphere_store.build(_spheres, _bvh.indices());
+}
+
+// Same as the member initializers do with the settings. The kernels depend on the reflection depth and SSAA
+void RayTracingManager::set_view(const _Camera& camera, const int& height, const float& ratio, const float& pixel_spacing, const int& SSAA) {
+    *_camera = camera;
+    _pixel_spacing = pixel_spacing;
+    _SSAA_factor = SSAA;
+    _displayed_ratio = ratio;
+    _displayed_height = height;
+    _displayed_width = _displayed_height * _displayed_ratio;
+    _upsampled_width = _SSAA_factor * _displayed_width / _pixel_spacing;
+    _upsampled_height = _SSAA_factor * _displayed_height / _pixel_spacing;
+    select_kernels();
+}
 
-    std::srand(static_cast<unsigned>(std::time(NULL)));
+// Light culling, again whenever lights move
+void RayTracingManager::build_lights() {
+    _light_culler.build(_lights);
+    _many_lights = _light_culler.ranged() || (_settings.light_samples > 0 && _lights.size() > static_cast<std::size_t>(_settings.light_samples));
 }
 
 RayTracingManager::~RayTracingManager() {
+    delete _denoiser;
+    delete _stats;
+    if (_owns_scheduler) delete _scheduler;
     delete _camera;
 }
@@ -0,0 +1,280 @@
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mesh.hpp"
+
+namespace {
+    inline float axis(const Vector3& v, const int& a) {
+        return a == 0 ? v.x : (a == 1 ? v.y : v.z);
+    }
+
+    // Watertight ray triangle intersection, https://jcgt.org/published/0002/01/05/
+    // The triangle gets sheared into a space where the ray goes along +z from the origin, so the test
+    // is three 2D edge functions. Edges shared by two triangles are decided the same way for both,
+    // a ray can never slip through between them. Edge functions of exactly 0 get redone in double
+    struct WatertightRay {
+        Vector3 origin;
+        int kx, ky, kz;
+        float sx, sy, sz;
+
+        explicit WatertightRay(const Ray& ray) : origin(ray.position) {
+            const Vector3 d = { std::abs(ray.direction.x), std::abs(ray.direction.y), std::abs(ray.direction.z) };
+            kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            if (axis(ray.direction, kz) < 0) std::swap(kx, ky);     // Keeps the winding
+
+            sx = axis(ray.direction, kx) / axis(ray.direction, kz);
+            sy = axis(ray.direction, ky) / axis(ray.direction, kz);
+            sz = 1.0f / axis(ray.direction, kz);
+        }
+
+        // Both sides count. t in (0, t_max]
+        [[nodiscard]] inline bool intersect(const Vector3& a, const Vector3& b, const Vector3& c, const float& t_max, float& t) const {
+            const Vector3 A = a - origin, B = b - origin, C = c - origin;
+            const float ax = axis(A, kx) - sx * axis(A, kz), ay = axis(A, ky) - sy * axis(A, kz);
+            const float bx = axis(B, kx) - sx * axis(B, kz), by = axis(B, ky) - sy * axis(B, kz);
+            const float cx = axis(C, kx) - sx * axis(C, kz), cy = axis(C, ky) - sy * axis(C, kz);
+
+            float u = cx * by - cy * bx;
+            float v = ax * cy - ay * cx;
+            float w = bx * ay - by * ax;
+            if (u == 0 || v == 0 || w == 0) {
+                u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+                v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+                w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+            }
+
+            if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+            const float det = u + v + w;
+            if (det == 0) return false;
+
+            // t * det, compared without dividing
+            const float scaled_t = u * sz * axis(A, kz) + v * sz * axis(B, kz) + w * sz * axis(C, kz);
+            if (det > 0 ? (scaled_t <= 0 || scaled_t > t_max * det) : (scaled_t >= 0 || scaled_t < t_max * det)) return false;
+
+            t = scaled_t / det;
+            return true;
+        }
+    };
+}
+
+////// AFFINE //////
+[[nodiscard]] Affine Affine::then(const Affine& next) const {
+    // Rows of next times the columns of this
+    const Vector3 cx = { x.x, y.x, z.x }, cy = { x.y, y.y, z.y }, cz = { x.z, y.z, z.z };
+    Affine result;
+    result.x = { utils::dot(next.x, cx), utils::dot(next.x, cy), utils::dot(next.x, cz) };
+    result.y = { utils::dot(next.y, cx), utils::dot(next.y, cy), utils::dot(next.y, cz) };
+    result.z = { utils::dot(next.z, cx), utils::dot(next.z, cy), utils::dot(next.z, cz) };
+    result.translation = next.point(translation);
+    return result;
+}
+
+// Adjugate over determinant
+[[nodiscard]] Affine Affine::inverse() const {
+    const Vector3 cx = { x.x, y.x, z.x }, cy = { x.y, y.y, z.y }, cz = { x.z, y.z, z.z };
+    const Vector3 r0 = utils::cross(cy, cz), r1 = utils::cross(cz, cx), r2 = utils::cross(cx, cy);
+    const float det = utils::dot(cx, r0);
+
+    Affine result;
+    result.x = r0 / det;
+    result.y = r1 / det;
+    result.z = r2 / det;
+    result.translation = -1 * result.direction(translation);
+    return result;
+}
+
+[[nodiscard]] Affine Affine::scale(const Vector3& s) {
+    Affine result;
+    result.x = { s.x, 0, 0 };
+    result.y = { 0, s.y, 0 };
+    result.z = { 0, 0, s.z };
+    return result;
+}
+
+[[nodiscard]] Affine Affine::rotate(const int& axis, const float& degrees) {
+    const float radians = degrees * std::numbers::pi_v<float> / 180.0f;
+    const float c = std::cos(radians), s = std::sin(radians);
+    Affine result;
+    if (axis == 0)      { result.y = { 0, c, -s }; result.z = { 0, s, c }; }
+    else if (axis == 1) { result.x = { c, 0, s };  result.z = { -s, 0, c }; }
+    else                { result.x = { c, -s, 0 }; result.y = { s, c, 0 }; }
+    return result;
+}
+
+[[nodiscard]] Affine Affine::translate(const Vector3& t) {
+    Affine result;
+    result.translation = t;
+    return result;
+}
+
+////// OBJ //////
+[[nodiscard]] bool read_obj_line(const std::string& command, std::istream& line, const std::size_t& first_vertex,
+                                 std::vector<Vector3>& vertices, std::vector<std::uint32_t>& indices) {
+    if (command == "v") {
+        Vector3 v;
+        if (!(line >> v.x >> v.y >> v.z)) return false;
+        vertices.push_back(v);
+        return true;
+    }
+    if (command != "f") return true;
+
+    // "7", "7/1", "7//3", "7/1/3" and "-1" are all vertex 7 (or the last one)
+    std::vector<std::uint32_t> corners;
+    std::string corner;
+    while (line >> corner) {
+        char* end;
+        const long index = std::strtol(corner.c_str(), &end, 10);
+        const long count = static_cast<long>(vertices.size() - first_vertex);
+        if (end == corner.c_str() || index == 0 || index > count || -index > count) return false;
+        corners.push_back(static_cast<std::uint32_t>(index > 0 ? index - 1 : count + index));
+    }
+    if (corners.size() < 3) return false;
+
+    for (std::size_t i = 1; i + 1 < corners.size(); i++) {
+        indices.push_back(corners[0]);
+        indices.push_back(corners[i]);
+        indices.push_back(corners[i + 1]);
+    }
+    return true;
+}
+
+[[nodiscard]] bool load_obj(const std::string& path, std::vector<Vector3>& vertices, std::vector<std::uint32_t>& indices) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Couldnt open mesh {" << path << "}\n";
+        return false;
+    }
+
+    const std::size_t first_vertex = vertices.size();
+    std::string raw_line;
+    for (int line_number = 1; std::getline(file, raw_line); line_number++) {
+        std::istringstream line(raw_line);
+        std::string command;
+        if (!(line >> command) || command[0] == '#') continue;
+
+        if (!read_obj_line(command, line, first_vertex, vertices, indices)) {
+            std::cerr << "Error: " << path << ":" << line_number << ": Malformed {" << command << "} line\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+////// MESH SCENE //////
+void MeshScene::build(const MeshView& view) {
+    _vertices = view.vertices;
+    _instances = view.instances;
+    _triangles.clear();
+    _accels.clear();
+    _accels.reserve(view.meshes.size());
+
+    // One BVH per mesh, the triangles get copied in its order so a leaf is one contiguous run
+    for (const Mesh& mesh : view.meshes) {
+        std::vector<AABB> bounds(mesh.index_count / 3);
+        for (std::uint32_t t = 0; t < bounds.size(); t++)
+            for (int corner = 0; corner < 3; corner++)
+                bounds[t].grow(_vertices[mesh.first_vertex + view.indices[mesh.first_index + 3 * t + corner]]);
+
+        Accel& accel = _accels.emplace_back();
+        accel.first_triangle = static_cast<std::uint32_t>(_triangles.size() / 3);
+        accel.first_vertex = mesh.first_vertex;
+        if (bounds.empty()) continue;
+
+        accel.bvh.build(bounds);
+        for (const int& t : accel.bvh.indices())
+            for (int corner = 0; corner < 3; corner++)
+                _triangles.push_back(view.indices[mesh.first_index + 3 * t + corner]);
+    }
+
+    // The instances get their mesh bounds moved to world space, the corners of the box are enough
+    std::vector<AABB> instance_bounds;
+    instance_bounds.reserve(_instances.size());
+    for (const MeshInstance& instance : _instances) {
+        AABB world;
+        const BVH& bvh = _accels[instance.mesh].bvh;
+        if (!bvh.empty()) {
+            const AABB& local = bvh.nodes()[0].bounds;
+            for (int corner = 0; corner < 8; corner++)
+                world.grow(instance.to_world.point({
+                    corner & 1 ? local.max.x : local.min.x,
+                    corner & 2 ? local.max.y : local.min.y,
+                    corner & 4 ? local.max.z : local.min.z
+                }));
+        }
+        instance_bounds.push_back(world);
+    }
+
+    _instance_bvh = BVH();
+    if (!instance_bounds.empty()) _instance_bvh.build(instance_bounds, 1);
+}
+
+// The ray moves into the object space of every instance it reaches. The direction isnt normalized
+// there, so t means the same distance in both spaces and one t_max works for all of them
+template <bool ANY_HIT>
+[[nodiscard]] bool MeshScene::traverse(const Ray& ray, float& t_max, MeshHit& hit, stats::Counters& counters) const {
+    bool found = false;
+
+    counters.bvh_nodes += _instance_bvh.traverse(ray, t_max, [&](const int& first, const int& count, float& instance_t_max) {
+        for (int i = first; i < first + count; i++) {
+            const int instance_index = _instance_bvh.indices()[i];
+            const MeshInstance& instance = _instances[instance_index];
+            const Accel& accel = _accels[instance.mesh];
+
+            const Ray object_ray = { instance.to_object.point(ray.position), instance.to_object.direction(ray.direction) };
+            const WatertightRay watertight(object_ray);
+
+            counters.bvh_nodes += accel.bvh.traverse(object_ray, instance_t_max, [&](const int& leaf_first, const int& leaf_count, float& mesh_t_max) {
+                counters.triangle_tests += leaf_count;
+                for (int k = leaf_first; k < leaf_first + leaf_count; k++) {
+                    const std::uint32_t triangle = accel.first_triangle + k;
+                    const Vector3& a = _vertices[accel.first_vertex + _triangles[3 * triangle]];
+                    const Vector3& b = _vertices[accel.first_vertex + _triangles[3 * triangle + 1]];
+                    const Vector3& c = _vertices[accel.first_vertex + _triangles[3 * triangle + 2]];
+
+                    float t;
+                    if (!watertight.intersect(a, b, c, mesh_t_max, t)) continue;
+                    mesh_t_max = t;
+                    hit = { instance_index, triangle, t };
+                    found = true;
+                    if constexpr (ANY_HIT) return true;
+                }
+                return false;
+            });
+
+            if (ANY_HIT && found) return true;
+        }
+        return false;
+    });
+
+    return found;
+}
+
+[[nodiscard]] bool MeshScene::intersect(const Ray& ray, float& t_max, MeshHit& hit, stats::Counters& counters) const {
+    return traverse<false>(ray, t_max, hit, counters);
+}
+
+[[nodiscard]] bool MeshScene::occluded(const Ray& ray, const float& t_max, stats::Counters& counters) const {
+    float t = t_max;
+    MeshHit hit;
+    return traverse<true>(ray, t, hit, counters);
+}
+
+void MeshScene::surface(const Ray& ray, const MeshHit& hit, Vector3& point, Vector3& normal) const {
+    const MeshInstance& instance = _instances[hit.instance];
+    const Accel& accel = _accels[instance.mesh];
+    const Vector3& a = _vertices[accel.first_vertex + _triangles[3 * hit.triangle]];
+    const Vector3& b = _vertices[accel.first_vertex + _triangles[3 * hit.triangle + 1]];
+    const Vector3& c = _vertices[accel.first_vertex + _triangles[3 * hit.triangle + 2]];
+
+    point = ray.position + hit.t * ray.direction;
+    normal = utils::normalize(instance.to_object.transposed(utils::cross(b - a, c - a)));
+    if (utils::dot(normal, ray.direction) > 0) normal = -1 * normal;
+}
@@ -0,0 +1,150 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include "options.hpp"
+
+namespace {
+    void print_usage(const char* program) {
+        std::cout
+            << "Usage: " << program << " [options]\n"
+            << "  -s, --scene PATH         Render a scene file (text or binary) instead of the built in one\n"
+            << "      --save-scene PATH    Save the scene as binary (mmaped when loaded) and exit\n"
+            << "      --animation PATH     Render every frame of an animation to --output, numbered (out_0000.png, ...)\n"
+            << "      --frames A[:B]       Only render frames A to B (or the end) of the animation, the ones before still apply\n"
+            << "      --coordinate [HOST:]PORT  Render with the workers that connect there (port 0 -> any free one).\n"
+            << "                           Only local ones without a HOST, 0.0.0.0:PORT for every machine\n"
+            << "      --spawn N            Start N local workers (and coordinate, on any free local port without --coordinate)\n"
+            << "      --worker HOST:PORT   Work for the coordinator at HOST:PORT until it is done\n"
+            << "      --serve ADDRESS      Keep the scenes clients load ready and render their jobs, on [HOST:]PORT (127.0.0.1 without HOST) or PATH\n"
+            << "      --client ADDRESS     Render on the server at HOST:PORT or PATH instead of here (needs --output)\n"
+            << "      --region X0,Y0,X1,Y1 Only render these pixels [X0, X1) x [Y0, Y1) of the image (--client only)\n"
+            << "  -o, --output PATH        Write the image to PATH (.png, .ppm or .exr)\n"
+            << "      --overwrite MODE     What to do when PATH exists: refuse (default), overwrite, unique\n"
+            << "      --band-height N      Render and write the image N rows at a time, for images that dont fit in memory\n"
+            << "      --headless           Dont open a window, only write the image (needs --output)\n"
+            << "  -i, --interactive        Move the camera around (WASD, R/F, the mouse wheel), coarse while moving and refined once still\n"
+            << "      --stats-json PATH    Write the render stats (stage times, ray counts, ...) as JSON\n"
+            << "      --heatmap PATH       Write an image of the work spent on every pixel\n"
+            << "      --height N           Displayed height in pixels\n"
+            << "      --ssaa N             SSAA factor, N*N samples per pixel\n"
+            << "      --threads N          Render threads, 0 -> every core\n"
+            << "      --depth N            Max reflection depth\n"
+            << "      --render-distance F  Nothing further away than this gets hit\n"
+            << "      --set KEY=VALUE      Any scene setting, same keys as the \"set\" lines of a scene file\n"
+            << "  -h, --help               Show this\n";
+    }
+
+    // Shorthands for --set
+    const std::map<std::string, std::string> SETTING_OPTIONS = {
+        {"-o", "output"}, {"--output", "output"},
+        {"--overwrite", "overwrite"},
+        {"--band-height", "band_height"},
+        {"--stats-json", "stats_json"},
+        {"--heatmap", "heatmap"},
+        {"--height", "height"},
+        {"--ssaa", "ssaa"},
+        {"--threads", "threads"},
+        {"--depth", "max_reflection_depth"},
+        {"--render-distance", "render_distance"},
+    };
+}
+
+[[nodiscard]] bool parse_arguments(const int& argc, char** argv, CommandLine& command_line, int& exit_code) {
+    exit_code = EXIT_FAILURE;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+
+        // Options that take a value
+        auto value = [&](std::string& out) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " needs a value\n";
+                return false;
+            }
+            out = argv[++i];
+            return true;
+        };
+
+        // Options that take a count
+        auto number = [&](int& out) {
+            std::string v;
+            if (!value(v)) return false;
+            char* end;
+            const long parsed = std::strtol(v.c_str(), &end, 10);
+            if (v.empty() || *end != '\0' || parsed < 0 || parsed > 1 << 30) {
+                std::cerr << "Error: Bad value {" << v << "} for " << arg << "\n";
+                return false;
+            }
+            out = static_cast<int>(parsed);
+            return true;
+        };
+
+        std::string v;
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            exit_code = EXIT_SUCCESS;
+            return false;
+        } else if (arg == "--headless") {
+            command_line.settings.emplace_back("headless", "1");
+        } else if (arg == "-i" || arg == "--interactive") {
+            command_line.interactive = true;
+        } else if (arg == "-s" || arg == "--scene") {
+            if (!value(command_line.scene_path)) return false;
+        } else if (arg == "--save-scene") {
+            if (!value(command_line.save_scene_path)) return false;
+        } else if (arg == "--animation") {
+            if (!value(command_line.animation_path)) return false;
+        } else if (arg == "--frames") {
+            // "5" -> 5 to the end, "5:9" -> 5 to 9
+            if (!value(v)) return false;
+            char* end;
+            const long first = std::strtol(v.c_str(), &end, 10);
+            long last = -1;
+            if (*end == ':') last = std::strtol(end + 1, &end, 10);
+            if (v.empty() || *end != '\0' || first < 0 || first > 1 << 30 || last > 1 << 30 || (last >= 0 && last < first) || (last < 0 && v.find(':') != std::string::npos)) {
+                std::cerr << "Error: Bad value {" << v << "} for " << arg << ", expected FIRST or FIRST:LAST\n";
+                return false;
+            }
+            command_line.first_frame = static_cast<int>(first);
+            command_line.last_frame = static_cast<int>(last);
+        } else if (arg == "--coordinate") {
+            if (!value(command_line.coordinate_address)) return false;
+        } else if (arg == "--spawn") {
+            if (!number(command_line.spawn_workers)) return false;
+        } else if (arg == "--worker") {
+            if (!value(command_line.worker_address)) return false;
+        } else if (arg == "--serve") {
+            if (!value(command_line.serve_address)) return false;
+        } else if (arg == "--client") {
+            if (!value(command_line.client_address)) return false;
+        } else if (arg == "--region") {
+            if (!value(v)) return false;
+            Tile& region = command_line.region;
+            char end = '\0';
+            if (std::sscanf(v.c_str(), "%d,%d,%d,%d%c", &region.x0, &region.y0, &region.x1, &region.y1, &end) != 4
+                || region.x0 < 0 || region.y0 < 0 || region.x1 <= region.x0 || region.y1 <= region.y0) {
+                std::cerr << "Error: Bad value {" << v << "} for " << arg << ", expected X0,Y0,X1,Y1\n";
+                return false;
+            }
+        } else if (SETTING_OPTIONS.contains(arg)) {
+            if (!value(v)) return false;
+            command_line.settings.emplace_back(SETTING_OPTIONS.at(arg), v);
+        } else if (arg == "--set") {
+            if (!value(v)) return false;
+            std::size_t equals = v.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << "Error: Expected --set KEY=VALUE, got {" << v << "}\n";
+                return false;
+            }
+            command_line.settings.emplace_back(v.substr(0, equals), v.substr(equals + 1));
+        } else {
+            std::cerr << "Error: Unknown option {" << arg << "}\n";
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
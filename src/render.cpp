@@ -1,68 +1,175 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <limits>
 #include <optional>
+#include <string>
 #include <raylib.h>
 #include <utility>
 #include <vector>
+#include "footprint.hpp"
 #include "manager.hpp"
 #include "objects.hpp"
+#include "shading.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 [[nodiscard]] bool RayTracingManager::scene_intersect(const Ray& ray, const Sphere*& h_sphere, Vector3& hit) const {
     float intersect_distance = std::numeric_limits<float>::max();
     float dummy_distance;
+    stats::Counters& counters = stats::local();
 
-    for (auto& sphere : _spheres) {
-        if (sphere.intersect(ray, dummy_distance)) {
-            if (intersect_distance > dummy_distance) {
-                intersect_distance = dummy_distance;
-                hit = ray.position + intersect_distance * ray.direction;
-                h_sphere = &sphere;
+    if (!_settings.use_bvh) {
+        counters.sphere_tests += _spheres.size();
+        for (auto& sphere : _spheres) {
+            if (sphere.intersect(ray, dummy_distance)) {
+                if (intersect_distance > dummy_distance) {
+                    intersect_distance = dummy_distance;
+                    hit = ray.position + intersect_distance * ray.direction;
+                    h_sphere = &sphere;
+                }
             }
         }
+
+        if (intersect_distance >= _camera->render_distance) return false;
+        footprint::touch(static_cast<int>(h_sphere - _spheres.data()));
+        return true;
+    }
+
+    // Nothing past the render distance counts, so the BVH can cull everything behind it.
+    // The sphere store is in BVH order, so a leaf is one contiguous run of slots
+    int closest = -1;
+    intersect_distance = _camera->render_distance;
+
+    counters.bvh_nodes += _bvh.traverse(ray, intersect_distance, [&](const int& first, const int& count, float& t_max) {
+        counters.sphere_tests += count;
+        int slot = _sphere_store.intersect(ray, first, count, t_max);
+        if (slot >= 0) closest = slot;
+        return false;
+    });
+
+    if (closest < 0) return false;
+    footprint::touch(_sphere_store.id(closest));
+    h_sphere = &_spheres[_sphere_store.id(closest)];
+    hit = ray.position + intersect_distance * ray.direction;
+    return true;
+}
+
+// Any hit query for shadow rays: is there something closer than max_distance?
+// Stops at the first leaf with a blocker and never computes the hit point.
+// last_occluder is the slot that blocked the previous query (-1 for none), it gets tested
+// before the BVH because neighbouring pixels are usually shadowed by the same sphere
+[[nodiscard]] bool RayTracingManager::scene_occluded(const Ray& ray, const float& max_distance, int& last_occluder) const {
+    stats::Counters& counters = stats::local();
+    if (!_settings.use_bvh) {
+        const Sphere* tmps; Vector3 shadow_hit;
+        if (scene_intersect(ray, tmps, shadow_hit) && utils::length(shadow_hit - ray.position) < max_distance) return true;
+        return !_mesh_scene.empty() && _mesh_scene.occluded(ray, std::min(max_distance, _camera->render_distance), counters);
+    }
+
+    float t_max = std::min(max_distance, _camera->render_distance);
+    if (last_occluder >= 0 && last_occluder < static_cast<int>(_sphere_store.size())) {
+        counters.sphere_tests++;
+        if (_sphere_store.intersect(ray, last_occluder, 1, t_max) >= 0) {
+            footprint::touch(_sphere_store.id(last_occluder));
+            return true;
+        }
     }
 
-    return intersect_distance < _camera->render_distance;
+    bool occluded = false;
+    counters.bvh_nodes += _bvh.traverse(ray, t_max, [&](const int& first, const int& count, float& t) {
+        counters.sphere_tests += count;
+        int slot = _sphere_store.intersect(ray, first, count, t);
+        if (slot < 0) return false;
+
+        last_occluder = slot;
+        occluded = true;
+        footprint::touch(_sphere_store.id(slot));
+        return true;
+    });
+
+    // Meshes dont move, so they arent worth remembering as the last occluder
+    return occluded || (!_mesh_scene.empty() && _mesh_scene.occluded(ray, std::min(max_distance, _camera->render_distance), counters));
+}
+
+// scene_intersect plus the meshes, with what shading needs from the hit
+[[nodiscard]] bool RayTracingManager::closest_hit(const Ray& ray, SurfaceHit& surface) const {
+    const Sphere* hit_sphere;
+    const bool hit_anything = scene_intersect(ray, hit_sphere, surface.point);
+    if (hit_anything) {
+        surface.normal = utils::normalize(surface.point - hit_sphere->center);
+        surface.material = &hit_sphere->material;
+        surface.object = static_cast<int>(hit_sphere - _spheres.data());
+    }
+    if (_mesh_scene.empty()) return hit_anything;
+
+    // Only a triangle in front of the sphere counts
+    float t_max = hit_anything ? utils::length(surface.point - ray.position) : _camera->render_distance;
+    MeshHit mesh_hit;
+    if (!_mesh_scene.intersect(ray, t_max, mesh_hit, stats::local())) return hit_anything;
+
+    _mesh_scene.surface(ray, mesh_hit, surface.point, surface.normal);
+    surface.material = &_mesh_scene.material(mesh_hit);
+    surface.object = static_cast<int>(_spheres.size()) + mesh_hit.instance;
+    return true;
 }
 
 
 [[nodiscard]] Vector3 RayTracingManager::cast_ray(
     const Ray& ray,
-    const int& reflection_depth
+    const int& reflection_depth,
+    const Sampler& sampler,
+    const shading::Path& path
 ) const {
-    // LERPING
-    Vector3 color_from = {0.5, 0.7, 1.0};
-    Vector3 color_to = {0.8, 0.8, 1.0};
-    float lerp = 0.5 - ray.direction.y;
+    Vector3 ambient_color = shading::sky(ray);
 
-    Vector3 ambient_color = (1 - lerp) * color_from + lerp * color_to;
-    Vector3 reflect_color = {0, 0, 0};
+    stats::Counters& counters = stats::local();
+    counters.depth_histogram[std::min(reflection_depth, stats::DEPTH_BINS - 1)]++;
 
-    Vector3 hit;              // This is the potential point of intesection
-    const Sphere* hit_sphere; // This is the potential sphere of intersection
-    if (!scene_intersect(ray, hit_sphere, hit)) return ambient_color;
-    else ambient_color = hit_sphere->material.albedo;
+    SurfaceHit surface;       // This is the potential point of intesection
+    const bool hit_anything = closest_hit(ray, surface);
+    if (reflection_depth > 0) footprint::reflection(ray.position, hit_anything ? surface.point : ray.position + _camera->render_distance * ray.direction);
 
-    const Vector3 hit_normal = utils::normalize(hit - hit_sphere->center);                              // N^     (variables from wiki)
-    const Vector3 viewing_direction = utils::normalize(_camera->position - hit);                        // V^     (variables from wiki)
+    if (!hit_anything) return ambient_color;
+    footprint::hit();
 
-    /// REFLECTION ///
-    if (hit_sphere->material.scattering_constant != 0 && reflection_depth < _camera->max_reflection_depth) {
-        Vector3 ray_direction = utils::normalize(utils::reflect(viewing_direction, hit_normal));
-        Vector3 ray_origin = utils::dot(ray_direction, hit_normal) < 0
-                             ? hit - 0.001 * hit_normal : hit + 0.001 * hit_normal;
+    return shade_hit(surface, reflection_depth, sampler, path);
+}
 
-        Vector3 rand3 = {utils::random_num(0, 1), utils::random_num(0, 1), utils::random_num(0, 1)}; rand3 *= (1 - hit_sphere->material.scattering_constant);
-        ray_direction += utils::dot(ray_direction, hit_normal) < 0 ? ray_direction - rand3: ray_direction + rand3;
-        ray_direction = utils::normalize(ray_direction);
+// Everything cast_ray does once it knows what it hit
+[[nodiscard]] Vector3 RayTracingManager::shade_hit(
+    const SurfaceHit& surface,
+    const int& reflection_depth,
+    const Sampler& sampler,
+    const shading::Path& path
+) const {
+    const Vector3& hit = surface.point;
+    const _Material& material = *surface.material;
+    stats::Counters& counters = stats::local();
 
-        reflect_color = cast_ray({
-                .position = ray_origin,
-                .direction = ray_direction
-            },
-            reflection_depth + 1
-        );
-    }
+    const Vector3& hit_normal = surface.normal;                                                         // N^     (variables from wiki)
+    const Vector3 viewing_direction = utils::normalize(_camera->position - hit);                        // V^     (variables from wiki)
+
+    // The lights come first, they decide how much the reflection can still add
+    auto with_reflection = [&](const Vector3& local) {
+        if (material.scattering_constant == 0 || reflection_depth >= _camera->max_reflection_depth) return utils::vecminmax(local);
+
+        /// REFLECTION ///
+        const shading::Bounce bounce = shading::follow(local, path, _settings.path_cutoff, _settings.roulette, sampler, reflection_depth);
+        Vector3 reflect_color = {0, 0, 0};
+        if (bounce.follow) {
+            counters.reflection_rays++;
+            reflect_color = cast_ray(
+                shading::reflection(hit, hit_normal, viewing_direction, material, sampler, reflection_depth),
+                reflection_depth + 1,
+                sampler,
+                bounce.path
+            );
+        } else counters.stopped_paths++;
+        return shading::with_reflection(local, reflect_color, bounce);
+    };
 
     ////////////////// PHONG LIGHTING MODEL //////////////////
         /* https://en.wikipedia.org/wiki/Phong_reflection_model */
@@ -101,24 +208,372 @@
         // ways to interpret a dot product
     ////////////////// PHONG LIGHTING MODEL //////////////////
 
-    float diffuse_lighting_intensity  = (hit_sphere->material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
-    float specular_lighting_intensity = (hit_sphere->material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
-    for (auto& light : _lights) {
+    float diffuse_lighting_intensity  = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+    float specular_lighting_intensity = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+
+    if (_many_lights) {
+        add_many_lights(material, hit, hit_normal, viewing_direction, reflection_depth, sampler, diffuse_lighting_intensity, specular_lighting_intensity);
+        return with_reflection((diffuse_lighting_intensity + specular_lighting_intensity) * material.albedo);
+    }
+
+    // Last sphere that shadowed each light on this thread
+    thread_local std::vector<int> last_occluders;
+    if (last_occluders.size() != _lights.size()) last_occluders.assign(_lights.size(), -1);
+
+    for (std::size_t l = 0; l < _lights.size(); l++) {
+        const Light& light = _lights[l];
         float light_length = utils::length(light.position - hit);
         const Vector3 light_direction = utils::normalize(light.position - hit);                     // L_m^   (variables from wiki)
-        const Vector3 reflection_direction = utils::reflect(light_direction, hit_normal);           // R_m^   (variables from wiki)
-        
+
         ////// SHADOWS //////
-        Vector3 shadow_origin = utils::dot(light_direction, hit_normal) < 0 ? hit - 1e-3 * hit_normal : hit + 1e-3 * hit_normal; // Is hit in shadow
-        Ray shadow_ray = {shadow_origin, light_direction };
-        const Sphere* tmps; Vector3 shadow_hit;
-        if (scene_intersect(shadow_ray, tmps, shadow_hit) && utils::length(shadow_hit - shadow_origin) < light_length)
+        const Ray shadow_ray = shading::shadow_ray(hit, hit_normal, light_direction);
+        counters.shadow_rays++;
+        footprint::shadow(l, shadow_ray.position);
+        if (scene_occluded(shadow_ray, light_length, last_occluders[l]))
             continue;
 
-        diffuse_lighting_intensity +=  hit_sphere->material.diffuse_reflection * light.diffuse_component * std::max(0.0f, utils::dot(light_direction, hit_normal));
-        float pow = std::pow(std::max(0.0f, utils::dot(reflection_direction, viewing_direction)), hit_sphere->material.specular_exponent);
-        specular_lighting_intensity += hit_sphere->material.specular_reflection * light.specular_component * pow;
+        shading::add_light(material, light, light_direction, hit_normal, viewing_direction, diffuse_lighting_intensity, specular_lighting_intensity);
+    }
+
+    return with_reflection((diffuse_lighting_intensity + specular_lighting_intensity) * material.albedo);
+}
+
+[[nodiscard]] Vector3 RayTracingManager::cast_primary(const Ray& ray, const Sampler& sampler, const shading::Path& path) const {
+    return cast_ray(ray, 0, sampler, path);
+}
+
+[[nodiscard]] Vector3 RayTracingManager::shade_primary(const SurfaceHit& surface, const Sampler& sampler, const shading::Path& path) const {
+    return shade_hit(surface, 0, sampler, path);
+}
+
+////// MANY LIGHTS //////
+// The lights of the culler that reach the hit. With more of them than light_samples, light_samples
+// get picked instead, stratified along the CDF of an estimate of what each adds (the lighting of
+// add_light without the specular lobe, which only makes it smaller, and without shadows). Every
+// pick is weighted by 1 / (light_samples * p), so on average the image is the one with every light.
+// An estimate of 0 means the light really adds nothing, so skipping those is free
+void RayTracingManager::add_many_lights(
+    const _Material& material,
+    const Vector3& hit,
+    const Vector3& hit_normal,
+    const Vector3& viewing_direction,
+    const int& reflection_depth,
+    const Sampler& sampler,
+    float& diffuse_lighting_intensity,
+    float& specular_lighting_intensity
+) const {
+    struct Candidate {
+        int light;
+        float distance;
+        float weight;                       // Range falloff
+        float cdf;                          // Running sum of the estimates
+    };
+
+    stats::Counters& counters = stats::local();
+    thread_local std::vector<Candidate> candidates;
+    thread_local std::vector<int> last_occluders;
+    if (last_occluders.size() != _lights.size()) last_occluders.assign(_lights.size(), -1);
+
+    candidates.clear();
+    float total = 0;
+    _light_culler.gather(hit, [&](const int& l) {
+        const Light& light = _lights[l];
+        const float distance = utils::length(light.position - hit);
+        const float weight = LightCuller::falloff(light, distance);
+        const float cosine = std::max(0.0f, utils::dot(utils::normalize(light.position - hit), hit_normal));
+        total += weight * (material.diffuse_reflection * light.diffuse_component * cosine + material.specular_reflection * light.specular_component);
+        candidates.push_back({l, distance, weight, total});
+    });
+
+    // Adds the light of c, scaled by share, unless it is shadowed
+    auto shade = [&](const Candidate& c, const float& share) {
+        const Light& light = _lights[c.light];
+        const Vector3 light_direction = utils::normalize(light.position - hit);
+
+        const Ray shadow_ray = shading::shadow_ray(hit, hit_normal, light_direction);
+        counters.shadow_rays++;
+        footprint::shadow(c.light, shadow_ray.position);
+        if (scene_occluded(shadow_ray, c.distance, last_occluders[c.light])) return;
+
+        Light scaled = light;
+        scaled.diffuse_component *= share;
+        scaled.specular_component *= share;
+        shading::add_light(material, scaled, light_direction, hit_normal, viewing_direction, diffuse_lighting_intensity, specular_lighting_intensity);
+    };
+
+    const int samples = _settings.light_samples;
+    if (samples == 0 || candidates.size() <= static_cast<std::size_t>(samples)) {
+        for (const Candidate& c : candidates) shade(c, c.weight);
+        return;
+    }
+    if (total <= 0) return;
+
+    // The strata are in CDF order, so picks of the same light come one after another
+    denoise::noisy = true;
+    const float offset = sampler.uniform(sampler_dimension::of(sampler_dimension::LIGHT, reflection_depth));
+    std::size_t c = 0;
+    for (int k = 0; k < samples;) {
+        const float u = (k + offset) / samples * total;
+        while (c + 1 < candidates.size() && candidates[c].cdf <= u) c++;
+
+        int picks = 0;
+        for (; k < samples && (c + 1 == candidates.size() || (k + offset) / samples * total < candidates[c].cdf); k++) picks++;
+
+        const float estimate = candidates[c].cdf - (c > 0 ? candidates[c - 1].cdf : 0);
+        if (estimate <= 0) continue;        // Only when rounding pushed u past the end
+        shade(candidates[c], candidates[c].weight * picks * total / (samples * estimate));
+    }
+}
+
+////// SPECIALISED KERNELS //////
+// cast_ray with the depth, the light count and "are there mirrors at all" known at compile time.
+// The recursion becomes MAX_DEPTH nested functions, the depth check and the light loop bounds
+// are constants and a scene without mirrors has no reflection code at all.
+// Same float operations as cast_ray, so the image is the same
+template <int MAX_DEPTH, int LIGHTS, bool REFLECTIVE, int DEPTH>
+[[nodiscard]] Vector3 RayTracingManager::trace(const Ray& ray, const Sampler& sampler, const shading::Path& path) const {
+    stats::Counters& counters = stats::local();
+    counters.depth_histogram[std::min(DEPTH, stats::DEPTH_BINS - 1)]++;
+
+    SurfaceHit surface;
+    const bool hit_anything = closest_hit(ray, surface);
+    if constexpr (DEPTH > 0) footprint::reflection(ray.position, hit_anything ? surface.point : ray.position + _camera->render_distance * ray.direction);
+
+    if (!hit_anything) return shading::sky(ray);
+    footprint::hit();
+
+    return shade<MAX_DEPTH, LIGHTS, REFLECTIVE, DEPTH>(surface, sampler, path);
+}
+
+// shade_hit of the specialised kernels
+template <int MAX_DEPTH, int LIGHTS, bool REFLECTIVE, int DEPTH>
+[[nodiscard]] Vector3 RayTracingManager::shade(const SurfaceHit& surface, const Sampler& sampler, const shading::Path& path) const {
+    stats::Counters& counters = stats::local();
+    const Vector3& hit = surface.point;
+    const _Material& material = *surface.material;
+    const Vector3& hit_normal = surface.normal;
+    const Vector3 viewing_direction = utils::normalize(_camera->position - hit);
+
+    float diffuse_lighting_intensity  = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+    float specular_lighting_intensity = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+
+    auto shade = [&](const std::size_t& l, int& last_occluder) {
+        const Light& light = _lights[l];
+        float light_length = utils::length(light.position - hit);
+        const Vector3 light_direction = utils::normalize(light.position - hit);
+
+        const Ray shadow_ray = shading::shadow_ray(hit, hit_normal, light_direction);
+        counters.shadow_rays++;
+        footprint::shadow(l, shadow_ray.position);
+        if (scene_occluded(shadow_ray, light_length, last_occluder)) return;
+        shading::add_light(material, light, light_direction, hit_normal, viewing_direction, diffuse_lighting_intensity, specular_lighting_intensity);
+    };
+
+    if constexpr (LIGHTS == 0) {
+        thread_local std::vector<int> last_occluders;
+        if (last_occluders.size() != _lights.size()) last_occluders.assign(_lights.size(), -1);
+        for (std::size_t l = 0; l < _lights.size(); l++) shade(l, last_occluders[l]);
+    } else {
+        // Constant initialized, so no thread_local guard on every call
+        static constexpr std::array<int, LIGHTS> NO_OCCLUDERS = [] { std::array<int, LIGHTS> a; a.fill(-1); return a; }();
+        thread_local std::array<int, LIGHTS> last_occluders = NO_OCCLUDERS;
+        for (std::size_t l = 0; l < LIGHTS; l++) shade(l, last_occluders[l]);
     }
 
-    return utils::vecminmax((diffuse_lighting_intensity + specular_lighting_intensity) * ambient_color + reflect_color);
+    const Vector3 local = (diffuse_lighting_intensity + specular_lighting_intensity) * material.albedo;
+    if constexpr (REFLECTIVE && DEPTH < MAX_DEPTH) {
+        if (material.scattering_constant != 0) {
+            const shading::Bounce bounce = shading::follow(local, path, _settings.path_cutoff, _settings.roulette, sampler, DEPTH);
+            Vector3 reflect_color = {0, 0, 0};
+            if (bounce.follow) {
+                counters.reflection_rays++;
+                reflect_color = trace<MAX_DEPTH, LIGHTS, REFLECTIVE, DEPTH + 1>(
+                    shading::reflection(hit, hit_normal, viewing_direction, material, sampler, DEPTH), sampler, bounce.path);
+            } else counters.stopped_paths++;
+            return shading::with_reflection(local, reflect_color, bounce);
+        }
+    }
+
+    return utils::vecminmax(local);
+}
+
+// The render_scene loop over one tile. With SSAA known the sample index math is multiplies and shifts
+template <int SSAA_FACTOR>
+void RayTracingManager::trace_tile(const Tile& tile, T_PIXEL& pixels, const float& tan_half_fov) const {
+    const int SSAA = SSAA_FACTOR ? SSAA_FACTOR : static_cast<int>(_SSAA_factor);
+    // Of the whole frame, pixels can be a window of it (render_region)
+    const int displayed_width = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int displayed_height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    stats::Counters& counters = stats::local();
+
+    float x, y;
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, (_y / SSAA) * displayed_width + _x / SSAA, (_y % SSAA) * SSAA + _x % SSAA, _settings.sampler_mode);
+            const Vector2 jitter = _settings.SSAA_jitter ? sampler.pixel_offset() : Vector2{0, 0};
+
+            x =  (2.0f * (_x + jitter.x) / _upsampled_width  - 1) * tan_half_fov * _displayed_ratio;
+            y = -(2.0f * (_y + jitter.y) / _upsampled_height - 1) * tan_half_fov;
+
+            const std::uint64_t cost = counters.cost();
+            counters.primary_rays++;
+            pixels.at(_x, _y) = trace_primary({
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            }, sampler);
+
+            // The last row / column of a frame that isnt a multiple of SSAA doesnt get displayed
+            if (_x < displayed_width * SSAA && _y < displayed_height * SSAA)
+                _stats->add_cost(_x / SSAA, _y / SSAA, counters.cost() - cost);
+        }
+    }
+}
+
+// trace_tile with the first hits from the G-buffer. record -> intersects the primary rays (and keeps the hits)
+// like trace_tile does, otherwise takes them from gbuffer and only shades. Either way the shading
+// is the one of the ray kernel, so the pixels are the same as trace_tile's
+void RayTracingManager::shade_tile(const Tile& tile, T_PIXEL& pixels, GBuffer& gbuffer, const bool& record, const float& tan_half_fov, FeatureBuffer* features) const {
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int displayed_width = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int displayed_height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    stats::Counters& counters = stats::local();
+
+    float x, y;
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, (_y / SSAA) * displayed_width + _x / SSAA, (_y % SSAA) * SSAA + _x % SSAA, _settings.sampler_mode);
+            const Vector2 jitter = _settings.SSAA_jitter ? sampler.pixel_offset() : Vector2{0, 0};
+
+            x =  (2.0f * (_x + jitter.x) / _upsampled_width  - 1) * tan_half_fov * _displayed_ratio;
+            y = -(2.0f * (_y + jitter.y) / _upsampled_height - 1) * tan_half_fov;
+            const Ray ray = {
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            };
+
+            const std::uint64_t cost = counters.cost();
+            counters.depth_histogram[0]++;
+            GSample& first = gbuffer.at(_x, _y);
+            if (record) {
+                counters.primary_rays++;
+                const Sphere* hit_sphere;
+                first.sphere = scene_intersect(ray, hit_sphere, first.point) ? static_cast<int>(hit_sphere - _spheres.data()) : -1;
+            } else if (first.sphere >= 0) {
+                footprint::touch(first.sphere);
+            }
+
+            denoise::noisy = false;
+            if (first.sphere < 0) {
+                pixels.at(_x, _y) = shading::sky(ray);
+                if (features) features->at(_x, _y) = { {0, 0, 0}, {0, 0, 0}, 0, -1, false };
+            } else {
+                footprint::hit();
+                const Sphere& sphere = _spheres[first.sphere];
+                const SurfaceHit surface = { first.point, utils::normalize(first.point - sphere.center), &sphere.material, first.sphere };
+                pixels.at(_x, _y) = shade_first_hit(surface, sampler);
+                if (features) features->at(_x, _y) = { surface.normal, sphere.material.albedo, utils::length(first.point - ray.position), first.sphere, denoise::noisy };
+            }
+
+            if (_x < displayed_width * SSAA && _y < displayed_height * SSAA)
+                _stats->add_cost(_x / SSAA, _y / SSAA, counters.cost() - cost);
+        }
+    }
+}
+
+// trace_tile for denoised renders, it also writes what the denoiser needs of every sample.
+// Intersects the primary rays itself and shades with the shade kernel, same pixels as trace_tile
+void RayTracingManager::feature_tile(const Tile& tile, T_PIXEL& pixels, FeatureBuffer& features, const float& tan_half_fov) const {
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    const int displayed_width = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int displayed_height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    stats::Counters& counters = stats::local();
+
+    float x, y;
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, (_y / SSAA) * displayed_width + _x / SSAA, (_y % SSAA) * SSAA + _x % SSAA, _settings.sampler_mode);
+            const Vector2 jitter = _settings.SSAA_jitter ? sampler.pixel_offset() : Vector2{0, 0};
+
+            x =  (2.0f * (_x + jitter.x) / _upsampled_width  - 1) * tan_half_fov * _displayed_ratio;
+            y = -(2.0f * (_y + jitter.y) / _upsampled_height - 1) * tan_half_fov;
+            const Ray ray = {
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            };
+
+            const std::uint64_t cost = counters.cost();
+            counters.primary_rays++;
+            counters.depth_histogram[0]++;
+            denoise::noisy = false;
+
+            SurfaceHit surface;
+            if (closest_hit(ray, surface)) {
+                footprint::hit();
+                pixels.at(_x, _y) = shade_first_hit(surface, sampler);
+                features.at(_x, _y) = { surface.normal, surface.material->albedo, utils::length(surface.point - ray.position), surface.object, denoise::noisy };
+            } else {
+                pixels.at(_x, _y) = shading::sky(ray);
+                features.at(_x, _y) = { {0, 0, 0}, {0, 0, 0}, 0, -1, false };
+            }
+
+            if (_x < displayed_width * SSAA && _y < displayed_height * SSAA)
+                _stats->add_cost(_x / SSAA, _y / SSAA, counters.cost() - cost);
+        }
+    }
+}
+
+// Depth 1 to 5, 1 to 4 lights (or any), with or without mirrors and SSAA 1 to 5 cover the usual scenes.
+// Everything else, or specialize=false, gets cast_ray and the generic tile loop
+void RayTracingManager::select_kernels() {
+    _ray_kernel = &RayTracingManager::cast_primary;
+    _shade_kernel = &RayTracingManager::shade_primary;
+    _tile_kernel = &RayTracingManager::trace_tile<0>;
+    _kernel_name = _many_lights ? "generic, many lights" : "generic";
+    if (!_settings.specialize) return;
+
+    auto with_lights = [&]<int MAX_DEPTH, bool REFLECTIVE>() -> std::pair<RayKernel, ShadeKernel> {
+        switch (_lights.size()) {
+            case 1:  return { &RayTracingManager::trace<MAX_DEPTH, 1, REFLECTIVE>, &RayTracingManager::shade<MAX_DEPTH, 1, REFLECTIVE> };
+            case 2:  return { &RayTracingManager::trace<MAX_DEPTH, 2, REFLECTIVE>, &RayTracingManager::shade<MAX_DEPTH, 2, REFLECTIVE> };
+            case 3:  return { &RayTracingManager::trace<MAX_DEPTH, 3, REFLECTIVE>, &RayTracingManager::shade<MAX_DEPTH, 3, REFLECTIVE> };
+            case 4:  return { &RayTracingManager::trace<MAX_DEPTH, 4, REFLECTIVE>, &RayTracingManager::shade<MAX_DEPTH, 4, REFLECTIVE> };
+            default: return { &RayTracingManager::trace<MAX_DEPTH, 0, REFLECTIVE>, &RayTracingManager::shade<MAX_DEPTH, 0, REFLECTIVE> };
+        }
+    };
+
+    // cast_ray reflects while depth < max_reflection_depth, so a fractional max depth rounds up
+    const int max_depth = static_cast<int>(std::ceil(std::max(0.0f, _camera->max_reflection_depth)));
+    const bool mirrors = max_depth > 0 && (std::any_of(_spheres.begin(), _spheres.end(), [](const Sphere& sphere) {
+        return sphere.material.scattering_constant != 0;
+    }) || std::any_of(_mesh_scene.instances().begin(), _mesh_scene.instances().end(), [](const MeshInstance& instance) {
+        return instance.material.scattering_constant != 0;
+    }));
+
+    std::pair<RayKernel, ShadeKernel> kernel = { nullptr, nullptr };
+    if (!mirrors) kernel = with_lights.template operator()<0, false>();
+    else switch (max_depth) {
+        case 1: kernel = with_lights.template operator()<1, true>(); break;
+        case 2: kernel = with_lights.template operator()<2, true>(); break;
+        case 3: kernel = with_lights.template operator()<3, true>(); break;
+        case 4: kernel = with_lights.template operator()<4, true>(); break;
+        case 5: kernel = with_lights.template operator()<5, true>(); break;
+    }
+
+    // Only cast_ray culls and samples lights
+    if (kernel.first && !_many_lights) {
+        _ray_kernel = kernel.first;
+        _shade_kernel = kernel.second;
+        _kernel_name = (mirrors ? "depth " + std::to_string(max_depth) : std::string("no mirrors"))
+                     + ", " + (_lights.size() <= 4 ? std::to_string(_lights.size()) : std::string("any")) + " lights";
+    }
+
+    switch (static_cast<int>(_SSAA_factor)) {
+        case 1: _tile_kernel = &RayTracingManager::trace_tile<1>; break;
+        case 2: _tile_kernel = &RayTracingManager::trace_tile<2>; break;
+        case 3: _tile_kernel = &RayTracingManager::trace_tile<3>; break;
+        case 4: _tile_kernel = &RayTracingManager::trace_tile<4>; break;
+        case 5: _tile_kernel = &RayTracingManager::trace_tile<5>; break;
+        default: return;
+    }
+    _kernel_name += ", ssaa " + std::to_string(static_cast<int>(_SSAA_factor));
 }
@@ -0,0 +1,410 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+#include "scene.hpp"
+
+namespace {
+    constexpr char BINARY_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    constexpr std::uint32_t BINARY_VERSION = 3;    // 2: lights have a range, 3: meshes
+    constexpr std::uint64_t BINARY_ALIGNMENT = 64;
+
+    // Every offset is from the start of the file and 64 byte aligned
+    struct BinaryHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t sphere_size;          // sizeof(Sphere) and sizeof(Light) of the writer,
+        std::uint32_t light_size;           // a file from a different layout gets refused
+        std::uint32_t reserved;
+        std::uint64_t sphere_count, sphere_offset;
+        std::uint64_t light_count, light_offset;
+        std::uint64_t settings_size, settings_offset;   // The set lines, as "key value\n" text
+        std::uint32_t mesh_size;            // sizeof(Mesh) and sizeof(MeshInstance), same reason
+        std::uint32_t instance_size;
+        std::uint64_t vertex_count, vertex_offset;
+        std::uint64_t index_count, index_offset;
+        std::uint64_t mesh_count, mesh_offset;
+        std::uint64_t instance_count, instance_offset;
+        _Camera camera;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Sphere> && std::is_trivially_copyable_v<Light> && std::is_trivially_copyable_v<_Camera>
+                  && std::is_trivially_copyable_v<Mesh> && std::is_trivially_copyable_v<MeshInstance>,
+                  "The binary scene format stores these as raw bytes");
+
+    // What a render server job brings along, see to_binary
+    const std::set<std::string> VIEW_SETTINGS = {
+        "output", "headless", "overwrite", "band_height", "stats", "stats_json", "heatmap",
+        "height", "ratio", "pixel_spacing", "ssaa",
+        "focal_length", "fov", "render_distance", "scene_lighting", "max_reflection_depth"
+    };
+
+    // count elements of element_size at offset are inside the size bytes of the file and start aligned,
+    // the arrays get used in place. Nothing here can overflow, whatever the header says
+    inline bool fits(const std::uint64_t& offset, const std::uint64_t& count, const std::uint64_t& element_size, const std::uint64_t& size) {
+        return offset % BINARY_ALIGNMENT == 0 && offset <= size && count <= (size - offset) / element_size;
+    }
+
+    inline std::uint64_t align(const std::uint64_t& offset) {
+        return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+    }
+}
+
+[[nodiscard]] bool read_material(std::istream& line, _Material& material) {
+    std::string key;
+    while (line >> key) {
+        if (key == "albedo")          line >> material.albedo.x >> material.albedo.y >> material.albedo.z;
+        else if (key == "ambient")    line >> material.ambient_reflection;
+        else if (key == "diffuse")    line >> material.diffuse_reflection;
+        else if (key == "specular")   line >> material.specular_reflection;
+        else if (key == "exponent")   line >> material.specular_exponent;
+        else if (key == "scattering") line >> material.scattering_constant;
+        else return false;
+
+        if (line.fail()) return false;
+    }
+    return true;
+}
+
+Scene::Mapping::~Mapping() {
+    munmap(data, size);
+}
+
+Scene::Scene(std::vector<Sphere> spheres, std::vector<Light> lights)
+    : _sphere_storage(std::move(spheres)), _light_storage(std::move(lights)) {
+    _spheres = _sphere_storage;
+    _lights = _light_storage;
+}
+
+[[nodiscard]] bool Scene::set(const std::string& key, const std::string& value) {
+    if (!apply_setting(key, value, settings, camera)) return false;
+    _set_lines.emplace_back(key, value);
+    return true;
+}
+
+[[nodiscard]] bool Scene::load(const std::string& path, Scene& scene) {
+    scene = Scene();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Couldnt open scene {" << path << "}\n";
+        return false;
+    }
+
+    struct stat info;
+    char magic[sizeof(BINARY_MAGIC)] = {};
+    bool binary = fstat(fd, &info) == 0
+               && read(fd, magic, sizeof(magic)) == sizeof(magic)
+               && std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+
+    bool loaded = binary ? scene.load_binary(path, fd, info.st_size) : scene.load_text(path);
+    close(fd);
+    return loaded;
+}
+
+////// TEXT //////
+[[nodiscard]] bool Scene::load_text(const std::string& path) {
+    std::ifstream file(path);
+    std::map<std::string, _Material> materials;
+    std::map<std::string, std::uint32_t> mesh_names;
+    bool inline_mesh = false;               // Between "mesh <name>" and "end", the v and f lines go into the last mesh
+    const std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+    // The vertices and indices added since the mesh started make it
+    auto finish_mesh = [&](const std::string& name) {
+        Mesh& mesh = _mesh_storage.back();
+        mesh.vertex_count = static_cast<std::uint32_t>(_vertex_storage.size() - mesh.first_vertex);
+        mesh.index_count = static_cast<std::uint32_t>(_index_storage.size() - mesh.first_index);
+        if (mesh.index_count == 0) {
+            std::cerr << "Error: " << path << ": Mesh {" << name << "} has no triangles\n";
+            return false;
+        }
+        return true;
+    };
+    std::string open_mesh;
+
+    std::string raw_line;
+    for (int line_number = 1; std::getline(file, raw_line); line_number++) {
+        auto fail = [&](const std::string& why) {
+            std::cerr << "Error: " << path << ":" << line_number << ": " << why << "\n";
+            return false;
+        };
+
+        std::size_t comment = raw_line.find('#');
+        if (comment != std::string::npos) raw_line.erase(comment);
+
+        std::istringstream line(raw_line);
+        std::string command;
+        if (!(line >> command)) continue;
+
+        if (inline_mesh) {
+            if (command == "end") {
+                inline_mesh = false;
+                if (!finish_mesh(open_mesh)) return false;
+            } else if (!read_obj_line(command, line, _mesh_storage.back().first_vertex, _vertex_storage, _index_storage)) {
+                return fail("Expected: v <x> <y> <z> or f <a> <b> <c> ... (or end)");
+            }
+            continue;
+        }
+
+        if (command == "set") {
+            std::string key, value;
+            if (!(line >> key >> value)) return fail("Expected: set <key> <value>");
+            if (!set(key, value)) return fail("Bad setting");
+        } else if (command == "camera") {
+            std::string key, value;
+            while (line >> key) {
+                if (key == "position") {
+                    if (!(line >> camera.position.x >> camera.position.y >> camera.position.z)) return fail("Expected: position <x> <y> <z>");
+                } else {
+                    if (!(line >> value)) return fail("Expected a value for {" + key + "}");
+                    if (!set(key, value)) return fail("Bad camera setting");
+                }
+            }
+        } else if (command == "material") {
+            std::string name;
+            _Material material = {
+                .albedo = {1, 1, 1},
+                .ambient_reflection = 1,
+                .diffuse_reflection = 0,
+                .specular_reflection = 0,
+                .specular_exponent = 1,
+                .scattering_constant = 0
+            };
+            if (!(line >> name) || !read_material(line, material)) return fail("Expected: material <name> [albedo r g b] [ambient a] [diffuse d] [specular s] [exponent e] [scattering s]");
+            materials[name] = material;
+        } else if (command == "light") {
+            Vector3 position;
+            float specular, diffuse, range;
+            if (!(line >> position.x >> position.y >> position.z >> specular >> diffuse)) return fail("Expected: light <x> <y> <z> <specular> <diffuse> [range]");
+            if (!(line >> range)) range = 0;
+            if (range < 0) return fail("A light range cant be negative");
+            _light_storage.push_back({position, specular, diffuse, range});
+        } else if (command == "sphere") {
+            Vector3 center;
+            float radius;
+            std::string material;
+            if (!(line >> center.x >> center.y >> center.z >> radius >> material)) return fail("Expected: sphere <x> <y> <z> <radius> <material>");
+            if (!materials.contains(material)) return fail("Unknown material {" + material + "}");
+            _sphere_storage.emplace_back(center, radius, materials[material]);
+        } else if (command == "mesh") {
+            std::string name, mesh_path;
+            if (!(line >> name)) return fail("Expected: mesh <name> [path.obj]");
+            if (mesh_names.contains(name)) return fail("Mesh {" + name + "} already exists");
+
+            mesh_names[name] = static_cast<std::uint32_t>(_mesh_storage.size());
+            _mesh_storage.push_back({ static_cast<std::uint32_t>(_vertex_storage.size()), 0, static_cast<std::uint32_t>(_index_storage.size()), 0 });
+            open_mesh = name;
+
+            if (!(line >> mesh_path)) {
+                inline_mesh = true;
+                continue;
+            }
+            if (mesh_path[0] != '/') mesh_path = directory + mesh_path;
+            if (!load_obj(mesh_path, _vertex_storage, _index_storage) || !finish_mesh(name)) return false;
+        } else if (command == "instance") {
+            std::string mesh, material, key;
+            if (!(line >> mesh >> material)) return fail("Expected: instance <mesh> <material> [scale s | scale x y z] [rotate x|y|z degrees] [translate x y z]");
+            if (!mesh_names.contains(mesh)) return fail("Unknown mesh {" + mesh + "}");
+            if (!materials.contains(material)) return fail("Unknown material {" + material + "}");
+
+            // In the order they are written
+            Affine to_world;
+            while (line >> key) {
+                if (key == "scale") {
+                    Vector3 scale;
+                    if (!(line >> scale.x)) return fail("Expected: scale <s> or scale <x> <y> <z>");
+                    if (!(line >> scale.y >> scale.z)) {
+                        line.clear();
+                        scale.y = scale.z = scale.x;
+                    }
+                    if (scale.x == 0 || scale.y == 0 || scale.z == 0) return fail("A scale cant be 0");
+                    to_world = to_world.then(Affine::scale(scale));
+                } else if (key == "rotate") {
+                    std::string axis;
+                    float degrees;
+                    if (!(line >> axis >> degrees) || (axis != "x" && axis != "y" && axis != "z")) return fail("Expected: rotate x|y|z <degrees>");
+                    to_world = to_world.then(Affine::rotate(axis[0] - 'x', degrees));
+                } else if (key == "translate") {
+                    Vector3 translation;
+                    if (!(line >> translation.x >> translation.y >> translation.z)) return fail("Expected: translate <x> <y> <z>");
+                    to_world = to_world.then(Affine::translate(translation));
+                } else {
+                    return fail("Unknown transform {" + key + "}");
+                }
+            }
+            _instance_storage.push_back({ mesh_names[mesh], to_world, to_world.inverse(), materials[material] });
+        } else {
+            return fail("Unknown command {" + command + "}");
+        }
+    }
+
+    if (inline_mesh) {
+        std::cerr << "Error: " << path << ": Mesh {" << open_mesh << "} is missing its end\n";
+        return false;
+    }
+
+    _spheres = _sphere_storage;
+    _lights = _light_storage;
+    _vertices = _vertex_storage;
+    _indices = _index_storage;
+    _meshes = _mesh_storage;
+    _instances = _instance_storage;
+    return true;
+}
+
+////// BINARY //////
+[[nodiscard]] bool Scene::load_binary(const std::string& path, const int& fd, const std::size_t& size) {
+    if (size < sizeof(BinaryHeader)) {
+        std::cerr << "Error: Binary scene {" << path << "}: Truncated header\n";
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "Error: Binary scene {" << path << "}: mmap failed\n";
+        return false;
+    }
+    _mapping.reset(new Mapping{data, size});
+
+    // The arrays are used straight from the mapping
+    if (!read_binary(static_cast<const char*>(data), size, path)) return false;
+    madvise(data, size, MADV_WILLNEED);
+    return true;
+}
+
+[[nodiscard]] bool Scene::from_binary(const std::string& bytes, Scene& scene) {
+    scene = Scene();
+    if (!scene.read_binary(bytes.data(), bytes.size(), "received")) return false;
+
+    // bytes doesnt outlive the scene, so the arrays get copied out of it
+    scene._sphere_storage.assign(scene._spheres.begin(), scene._spheres.end());
+    scene._light_storage.assign(scene._lights.begin(), scene._lights.end());
+    scene._vertex_storage.assign(scene._vertices.begin(), scene._vertices.end());
+    scene._index_storage.assign(scene._indices.begin(), scene._indices.end());
+    scene._mesh_storage.assign(scene._meshes.begin(), scene._meshes.end());
+    scene._instance_storage.assign(scene._instances.begin(), scene._instances.end());
+    scene._spheres = scene._sphere_storage;
+    scene._lights = scene._light_storage;
+    scene._vertices = scene._vertex_storage;
+    scene._indices = scene._index_storage;
+    scene._meshes = scene._mesh_storage;
+    scene._instances = scene._instance_storage;
+    return true;
+}
+
+// Checks the header and applies the set lines. The arrays are left where they are in bytes
+[[nodiscard]] bool Scene::read_binary(const char* bytes, const std::size_t& size, const std::string& name) {
+    auto fail = [&](const std::string& why) {
+        std::cerr << "Error: Binary scene {" << name << "}: " << why << "\n";
+        return false;
+    };
+
+    if (size < sizeof(BinaryHeader)) return fail("Truncated header");
+
+    BinaryHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+
+    if (std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) return fail("Not a binary scene");
+    if (header.version != BINARY_VERSION) return fail("Unsupported version " + std::to_string(header.version));
+    if (header.sphere_size != sizeof(Sphere) || header.light_size != sizeof(Light)
+        || header.mesh_size != sizeof(Mesh) || header.instance_size != sizeof(MeshInstance))
+        return fail("Written by a build with a different memory layout");
+    if (!fits(header.sphere_offset, header.sphere_count, sizeof(Sphere), size)
+        || !fits(header.light_offset, header.light_count, sizeof(Light), size)
+        || !fits(header.settings_offset, header.settings_size, 1, size)
+        || !fits(header.vertex_offset, header.vertex_count, sizeof(Vector3), size)
+        || !fits(header.index_offset, header.index_count, sizeof(std::uint32_t), size)
+        || !fits(header.mesh_offset, header.mesh_count, sizeof(Mesh), size)
+        || !fits(header.instance_offset, header.instance_count, sizeof(MeshInstance), size))
+        return fail("Truncated data or misaligned parts");
+
+    _spheres = { reinterpret_cast<const Sphere*>(bytes + header.sphere_offset), header.sphere_count };
+    _lights = { reinterpret_cast<const Light*>(bytes + header.light_offset), header.light_count };
+    _vertices = { reinterpret_cast<const Vector3*>(bytes + header.vertex_offset), header.vertex_count };
+    _indices = { reinterpret_cast<const std::uint32_t*>(bytes + header.index_offset), header.index_count };
+    _meshes = { reinterpret_cast<const Mesh*>(bytes + header.mesh_offset), header.mesh_count };
+    _instances = { reinterpret_cast<const MeshInstance*>(bytes + header.instance_offset), header.instance_count };
+
+    // The renderer trusts the ranges, a broken file shouldnt make it read past the arrays
+    for (const Mesh& mesh : _meshes) {
+        if (static_cast<std::uint64_t>(mesh.first_vertex) + mesh.vertex_count > _vertices.size()
+            || static_cast<std::uint64_t>(mesh.first_index) + mesh.index_count > _indices.size() || mesh.index_count % 3 != 0 || mesh.index_count == 0)
+            return fail("Mesh out of range");
+        for (std::uint32_t i = mesh.first_index; i < mesh.first_index + mesh.index_count; i++)
+            if (_indices[i] >= mesh.vertex_count) return fail("Index out of range");
+    }
+    for (const MeshInstance& instance : _instances)
+        if (instance.mesh >= _meshes.size()) return fail("Instance of a missing mesh");
+
+    camera = header.camera;
+    std::istringstream set_lines(std::string(bytes + header.settings_offset, header.settings_size));
+    std::string key, value;
+    while (set_lines >> key >> value)
+        if (!set(key, value)) return fail("Bad setting");
+
+    return true;
+}
+
+[[nodiscard]] std::string Scene::to_binary(const bool& view) const {
+    std::string set_lines;
+    for (auto& [key, value] : _set_lines)
+        if (view || !VIEW_SETTINGS.contains(key)) set_lines += key + " " + value + "\n";
+
+    BinaryHeader header = {};
+    std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version = BINARY_VERSION;
+    header.sphere_size = sizeof(Sphere);
+    header.light_size = sizeof(Light);
+    header.sphere_count = _spheres.size();
+    header.sphere_offset = align(sizeof(BinaryHeader));
+    header.light_count = _lights.size();
+    header.light_offset = align(header.sphere_offset + _spheres.size_bytes());
+    header.settings_size = set_lines.size();
+    header.settings_offset = align(header.light_offset + _lights.size_bytes());
+    header.mesh_size = sizeof(Mesh);
+    header.instance_size = sizeof(MeshInstance);
+    header.vertex_count = _vertices.size();
+    header.vertex_offset = align(header.settings_offset + header.settings_size);
+    header.index_count = _indices.size();
+    header.index_offset = align(header.vertex_offset + _vertices.size_bytes());
+    header.mesh_count = _meshes.size();
+    header.mesh_offset = align(header.index_offset + _indices.size_bytes());
+    header.instance_count = _instances.size();
+    header.instance_offset = align(header.mesh_offset + _meshes.size_bytes());
+    header.camera = view ? camera : _Camera{};
+
+    // Zero padded between the parts
+    std::string bytes(header.instance_offset + _instances.size_bytes(), '\0');
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + header.sphere_offset, _spheres.data(), _spheres.size_bytes());
+    std::memcpy(bytes.data() + header.light_offset, _lights.data(), _lights.size_bytes());
+    std::memcpy(bytes.data() + header.settings_offset, set_lines.data(), set_lines.size());
+    std::memcpy(bytes.data() + header.vertex_offset, _vertices.data(), _vertices.size_bytes());
+    std::memcpy(bytes.data() + header.index_offset, _indices.data(), _indices.size_bytes());
+    std::memcpy(bytes.data() + header.mesh_offset, _meshes.data(), _meshes.size_bytes());
+    std::memcpy(bytes.data() + header.instance_offset, _instances.data(), _instances.size_bytes());
+    return bytes;
+}
+
+[[nodiscard]] bool Scene::save_binary(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Couldnt write {" << path << "}\n";
+        return false;
+    }
+
+    const std::string bytes = to_binary();
+    file.write(bytes.data(), bytes.size());
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "scheduler.hpp"
+
+TileScheduler::TileScheduler(const int& thread_count) {
+    _thread_count = thread_count > 0
+                    ? thread_count : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    _queues = std::make_unique<WorkQueue[]>(_thread_count);
+
+    for (int i = 1; i < _thread_count; i++)
+        _threads.emplace_back(&TileScheduler::worker_loop, this, i);
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) thread.join();
+}
+
+[[nodiscard]] std::vector<Tile> TileScheduler::split(const int& width, const int& height, const int& tile_size) {
+    std::vector<Tile> tiles;
+    tiles.reserve(((width + tile_size - 1) / tile_size) * ((height + tile_size - 1) / tile_size));
+
+    for (int y = 0; y < height; y += tile_size)
+        for (int x = 0; x < width; x += tile_size)
+            tiles.push_back({x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+
+    return tiles;
+}
+
+void TileScheduler::run(const std::vector<Tile>& tiles, const TileJob& job) {
+    if (tiles.empty()) return;
+
+    // Deal out contiguous chunks, so neighbouring tiles stay on the same core
+    const int tile_count = static_cast<int>(tiles.size());
+    for (int t = 0; t < _thread_count; t++) {
+        std::lock_guard<std::mutex> lock(_queues[t].mutex);
+        _queues[t].tiles.clear();
+        for (int i = tile_count * t / _thread_count; i < tile_count * (t + 1) / _thread_count; i++)
+            _queues[t].tiles.push_back(i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tiles = &tiles;
+        _job = &job;
+        _busy = _thread_count - 1;
+        _generation++;
+    }
+    _wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busy == 0; });
+    _tiles = nullptr;
+    _job = nullptr;
+}
+
+void TileScheduler::worker_loop(const int thread_id) {
+    std::uint64_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != seen_generation; });
+            if (_stop) return;
+            seen_generation = _generation;
+        }
+
+        work(thread_id);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_busy == 0) _done.notify_one();
+    }
+}
+
+void TileScheduler::work(const int& thread_id) {
+    int tile;
+    while (next_tile(thread_id, tile))
+        (*_job)((*_tiles)[tile], thread_id);
+}
+
+[[nodiscard]] bool TileScheduler::next_tile(const int& thread_id, int& tile) {
+    {
+        WorkQueue& own = _queues[thread_id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of the others, starting with the neighbour
+    for (int i = 1; i < _thread_count; i++) {
+        WorkQueue& victim = _queues[(thread_id + i) % _thread_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
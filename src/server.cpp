@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "distributed.hpp"
+#include "image_writer.hpp"
+#include "manager.hpp"
+#include "server.hpp"
+
+namespace {
+    constexpr float SEND_TIMEOUT = 30;                  // Seconds a client can take to read its image before it gets dropped
+    constexpr std::uint64_t MAX_SAMPLES = 1ull << 28;   // Per job, 3 GB of samples
+    constexpr float MAX_DEPTH = 256;                    // Of the camera of a job, the reflections recurse that deep
+
+    volatile std::sig_atomic_t stopping = 0;
+
+    void stop(int) { stopping = 1; }
+
+    // [host:]port, or the path of a local socket. Non blocking, -1 (and prints why) when it cant
+    int listen_on(const std::string& address) {
+        int fd = -1;
+        if (address.find('/') != std::string::npos) {
+            sockaddr_un local = {};
+            local.sun_family = AF_UNIX;
+            if (address.size() >= sizeof(local.sun_path)) {
+                std::cerr << "Error: The socket path {" << address << "} is too long\n";
+                return -1;
+            }
+            std::memcpy(local.sun_path, address.c_str(), address.size());
+
+            // Left over from a server that got killed. Anything else that is there stays
+            struct stat existing;
+            if (stat(address.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(address.c_str());
+
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 || listen(fd, 64) != 0)) {
+                std::cerr << "Error: Couldnt listen on {" << address << "}: " << std::strerror(errno) << "\n";
+                close(fd);
+                return -1;
+            }
+            std::cout << "Server: listening on " << address << "\n";
+        } else {
+            // Only this machine can connect unless a host says otherwise, a scene is whatever a client sends
+            const std::size_t colon = address.rfind(':');
+            const std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+            const std::string port_text = colon == std::string::npos ? address : address.substr(colon + 1);
+            char* end;
+            const long port = std::strtol(port_text.c_str(), &end, 10);
+            sockaddr_in bound = {};
+            bound.sin_family = AF_INET;
+            if (port_text.empty() || *end != '\0' || port < 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &bound.sin_addr) != 1) {
+                std::cerr << "Error: Expected --serve [HOST:]PORT (HOST an IPv4 address) or the path of a socket, got {" << address << "}\n";
+                return -1;
+            }
+            bound.sin_port = htons(static_cast<std::uint16_t>(port));
+
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+            socklen_t length = sizeof(bound);
+            if (fd >= 0 && (bind(fd, reinterpret_cast<sockaddr*>(&bound), sizeof(bound)) != 0 || listen(fd, 64) != 0
+                || getsockname(fd, reinterpret_cast<sockaddr*>(&bound), &length) != 0)) {
+                std::cerr << "Error: Couldnt listen on " << host << ":" << port << ": " << std::strerror(errno) << "\n";
+                close(fd);
+                return -1;
+            }
+            std::cout << "Server: listening on " << host << ":" << ntohs(bound.sin_port) << "\n";
+        }
+        if (fd < 0) {
+            std::cerr << "Error: Couldnt make a socket: " << std::strerror(errno) << "\n";
+            return -1;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    // Displayed size of the image, the same way the renderer works it out from the settings.
+    // False when it doesnt fit in an int (a tiny pixel_spacing), the casts would be undefined
+    bool image_size(const server::Job& job, int& width, int& height) {
+        const int displayed_width = job.height * job.ratio;
+        const double samples_x = std::ceil(job.SSAA * displayed_width / job.pixel_spacing);
+        const double samples_y = std::ceil(job.SSAA * job.height / job.pixel_spacing);
+        if (!(samples_x < MAX_SAMPLES && samples_y < MAX_SAMPLES)) return false;
+        width  = static_cast<int>(samples_x) / job.SSAA;
+        height = static_cast<int>(samples_y) / job.SSAA;
+        return true;
+    }
+
+    double seconds_since(const std::chrono::steady_clock::time_point& start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+////// SCENE CACHE //////
+server::SceneCache::~SceneCache() {
+    while (!_entries.empty()) drop(_entries.begin());
+}
+
+void server::SceneCache::drop(std::list<Entry>::iterator entry) {
+    delete entry->renderer;
+    delete entry->scene;
+    _memory -= entry->memory;
+    _entries.erase(entry);
+}
+
+[[nodiscard]] bool server::SceneCache::load(const std::string& bytes, std::uint32_t& handle, std::string& error) {
+    const std::size_t key = std::hash<std::string>{}(bytes);
+    for (auto entry = _entries.begin(); entry != _entries.end(); entry++) {
+        if (entry->key != key || entry->bytes != bytes) continue;
+        _entries.splice(_entries.begin(), _entries, entry);
+        handle = entry->handle;
+        std::cout << "Server: scene " << handle << " is loaded already\n";
+        return true;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    Scene* scene = new Scene();
+    if (!Scene::from_binary(bytes, *scene)) {
+        delete scene;
+        error = "The scene doesnt load";
+        return false;
+    }
+    for (auto& [key, value] : _settings) {
+        if (scene->set(key, value)) continue;
+        delete scene;
+        error = "The server setting " + key + " doesnt apply";
+        return false;
+    }
+
+    // The bytes, the scene made from them and the BVHs and the sphere store built from that take about as much each
+    _entries.push_front({
+        .handle = _next_handle++, .key = key, .bytes = bytes, .memory = 3 * bytes.size(), .scene = scene,
+        .renderer = new RayTracingManager(scene->spheres(), scene->lights(), scene->camera, scene->settings, scene->meshes(), &_scheduler)
+    });
+    const Entry& entry = _entries.front();
+    _memory += entry.memory;
+    handle = entry.handle;
+    std::cout << "Server: loaded scene " << handle << " (" << (entry.memory >> 10) << " KB) in " << seconds_since(start) << " s\n";
+
+    // The new one stays, even when it doesnt fit on its own
+    while (_memory > _memory_cap && _entries.size() > 1) {
+        std::cout << "Server: dropped scene " << _entries.back().handle << "\n";
+        drop(std::prev(_entries.end()));
+    }
+    if (_memory > _memory_cap) std::cerr << "Warning: Scene " << handle << " alone takes more than server_memory\n";
+    return true;
+}
+
+[[nodiscard]] RayTracingManager* server::SceneCache::find(const std::uint32_t& handle) {
+    for (auto entry = _entries.begin(); entry != _entries.end(); entry++) {
+        if (entry->handle != handle) continue;
+        _entries.splice(_entries.begin(), _entries, entry);
+        return entry->renderer;
+    }
+    return nullptr;
+}
+
+////// SERVER //////
+[[nodiscard]] int server::serve(const std::string& address, const std::vector<std::pair<std::string, std::string>>& settings) {
+    using distributed::MessageType;
+
+    // Bad settings show up now, not with the first scene
+    Scene defaults;
+    for (auto& [key, value] : settings)
+        if (!defaults.set(key, value)) return EXIT_FAILURE;
+
+    // It runs until it gets stopped, what it did should be in the log by then, not in a buffer
+    std::cout << std::unitbuf;
+    const int listening = listen_on(address);
+    if (listening < 0) return EXIT_FAILURE;
+    const bool local = address.find('/') != std::string::npos;
+
+    // A client going away shows up as a failed send, not a signal
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+
+    TileScheduler scheduler(defaults.settings.thread_count);
+    const std::size_t memory_cap = static_cast<std::size_t>(defaults.settings.server_memory) << 20;
+    SceneCache cache(memory_cap, settings, scheduler);
+
+    struct Client {
+        std::uint64_t id;
+        std::unique_ptr<distributed::Connection> connection;
+        bool greeted = false;               // Said HELLO with the right PROTOCOL_VERSION
+    };
+    struct Queued {
+        std::uint64_t client;
+        std::uint32_t number;
+        Job job;
+    };
+    std::vector<Client> clients;
+    std::deque<Queued> queue;
+    std::uint64_t next_client = 0;
+    std::uint64_t jobs_done = 0;
+
+    // false when the client gets dropped, for saying something it shouldnt or not taking the answer
+    auto handle = [&](Client& client, const distributed::MessageHeader& header, const std::string& payload) {
+        distributed::Connection& connection = *client.connection;
+        if (!client.greeted) {
+            client.greeted = header.type == MessageType::HELLO && payload.size() == sizeof(distributed::PROTOCOL_VERSION)
+                          && std::memcmp(payload.data(), &distributed::PROTOCOL_VERSION, sizeof(distributed::PROTOCOL_VERSION)) == 0;
+            if (!client.greeted) {
+                const std::string why = "The client isnt the same build as the server";
+                (void)connection.send(MessageType::FAILED, 0, why.data(), why.size());
+            }
+            return client.greeted;
+        }
+
+        if (header.type == MessageType::LOAD) {
+            std::uint32_t scene = 0;
+            std::string error;
+            if (cache.load(payload, scene, error)) return connection.send(MessageType::LOADED, scene);
+            return connection.send(MessageType::FAILED, 0, error.data(), error.size());
+        }
+        if (header.type == MessageType::RENDER && payload.size() == sizeof(Job)) {
+            Queued queued = { client.id, header.tile, {} };
+            std::memcpy(&queued.job, payload.data(), sizeof(Job));
+            queue.push_back(queued);
+            return true;
+        }
+        return false;
+    };
+
+    // The pixels of the job, false (and why) when it cant be done
+    auto render = [&](const Job& job, T_COLOR& colors, Tile& region, std::string& error) {
+        RayTracingManager* renderer = cache.find(job.scene);
+        if (!renderer) {
+            error = "Scene " + std::to_string(job.scene) + " isnt loaded (anymore), load it again";
+            return false;
+        }
+
+        int width = 0, height = 0;
+        const bool resolution = job.height > 0 && job.height <= 1 << 16 && job.ratio > 0 && job.ratio <= 64
+                             && job.pixel_spacing > 0 && job.SSAA > 0 && job.SSAA <= 64 && image_size(job, width, height);
+        region = job.region.x1 > job.region.x0 && job.region.y1 > job.region.y0 ? job.region : Tile{ 0, 0, width, height };
+        if (!resolution || width <= 0 || height <= 0 || region.x0 < 0 || region.y0 < 0 || region.x1 > width || region.y1 > height) {
+            error = "Bad resolution or region";
+            return false;
+        }
+        if (static_cast<std::uint64_t>(region.x1 - region.x0) * (region.y1 - region.y0) * job.SSAA * job.SSAA > MAX_SAMPLES) {
+            error = "Too many samples for one job, split it into regions";
+            return false;
+        }
+        if (!(job.camera.max_reflection_depth >= 0 && job.camera.max_reflection_depth <= MAX_DEPTH)) {
+            error = "max_reflection_depth has to be between 0 and " + std::to_string(static_cast<int>(MAX_DEPTH));
+            return false;
+        }
+
+        renderer->set_view(job.camera, job.height, job.ratio, job.pixel_spacing, job.SSAA);
+        colors = renderer->render_region(region);
+        return true;
+    };
+
+    while (!stopping) {
+        std::vector<pollfd> fds = {{ listening, POLLIN, 0 }};
+        for (const Client& client : clients) fds.push_back({ client.connection->fd(), POLLIN, 0 });
+
+        // Only waits when there is nothing to render
+        if (poll(fds.data(), fds.size(), queue.empty() ? -1 : 0) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: Couldnt wait for the clients: " << std::strerror(errno) << "\n";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listening, nullptr, nullptr)) >= 0) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                int on = 1;
+                if (!local) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                clients.push_back({ next_client++, std::make_unique<distributed::Connection>(fd, SEND_TIMEOUT) });
+                clients.back().connection->limit(memory_cap);     // A scene that doesnt fit isnt even read
+            }
+        }
+
+        // What arrived before a client went away still gets handled, its jobs dont.
+        // The clients accepted just now arent in fds yet, they get polled next time
+        std::vector<std::uint64_t> gone;
+        for (std::size_t c = 0; c + 1 < fds.size(); c++) {
+            if (!(fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            bool open = clients[c].connection->receive();
+
+            distributed::MessageHeader header;
+            std::string payload;
+            while (open && clients[c].connection->next(header, payload)) open = handle(clients[c], header, payload);
+            if (clients[c].connection->too_big()) {
+                std::cout << "Server: refused a message bigger than server_memory from client " << clients[c].id << "\n";
+                const std::string why = "The message is bigger than server_memory";
+                (void)clients[c].connection->send(MessageType::FAILED, 0, why.data(), why.size());
+                open = false;
+            }
+            if (!open) gone.push_back(clients[c].id);
+        }
+        for (const std::uint64_t id : gone) {
+            std::erase_if(clients, [&](const Client& client) { return client.id == id; });
+            std::erase_if(queue, [&](const Queued& queued) { return queued.client == id; });
+        }
+
+        if (queue.empty()) continue;
+        const Queued queued = queue.front();
+        queue.pop_front();
+        auto client = std::find_if(clients.begin(), clients.end(), [&](const Client& c) { return c.id == queued.client; });
+
+        const auto start = std::chrono::steady_clock::now();
+        T_COLOR colors;
+        Tile region;
+        std::string error;
+        bool sent;
+        if (render(queued.job, colors, region, error)) {
+            std::string pixels(sizeof(region) + colors.size() * sizeof(Color), '\0');
+            std::memcpy(pixels.data(), &region, sizeof(region));
+            std::memcpy(pixels.data() + sizeof(region), colors.data(), colors.size() * sizeof(Color));
+            sent = client->connection->send(MessageType::IMAGE, queued.number, pixels.data(), pixels.size());
+            std::cout << "Server: job " << queued.number << " of client " << queued.client << ", scene " << queued.job.scene << ", "
+                      << colors.width() << "x" << colors.height() << " ssaa " << queued.job.SSAA << " in " << seconds_since(start) << " s\n";
+            jobs_done++;
+        } else {
+            sent = client->connection->send(MessageType::FAILED, queued.number, error.data(), error.size());
+        }
+        if (!sent) {
+            std::erase_if(queue, [&](const Queued& q) { return q.client == queued.client; });
+            clients.erase(client);
+        }
+    }
+
+    close(listening);
+    if (local) unlink(address.c_str());
+    std::cout << "Server: stopped after " << jobs_done << " jobs, " << cache.size() << " scenes (" << (cache.memory() >> 10) << " KB) were loaded\n";
+    return EXIT_SUCCESS;
+}
+
+////// CLIENT //////
+[[nodiscard]] int server::request(const std::string& address, const Scene& scene, const Tile& region) {
+    using distributed::MessageType;
+
+    if (scene.settings.output_path.empty()) {
+        std::cerr << "Error: --client needs --output\n";
+        return EXIT_FAILURE;
+    }
+    std::string output_path;
+    if (!image::resolve_path(scene.settings.output_path, scene.settings.overwrite, output_path)) return EXIT_FAILURE;
+
+    std::signal(SIGPIPE, SIG_IGN);
+    const std::unique_ptr<distributed::Connection> connection = distributed::connect(address, -1);
+    if (!connection) return EXIT_FAILURE;
+
+    // The next message, FAILED gets printed. false when there is none
+    distributed::MessageHeader header;
+    std::string payload;
+    auto answer = [&]() {
+        while (!connection->next(header, payload)) {
+            if (!connection->receive()) {
+                std::cerr << "Error: Lost the server\n";
+                return false;
+            }
+        }
+        if (header.type == MessageType::FAILED) std::cerr << "Error: " << payload << "\n";
+        return header.type != MessageType::FAILED;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::string bytes = scene.to_binary(false);
+    // A server that refuses the scene can say why before it hangs up, so thats read even when the send failed
+    const bool sent = connection->send(MessageType::HELLO, 0, &distributed::PROTOCOL_VERSION, sizeof(distributed::PROTOCOL_VERSION))
+                   && connection->send(MessageType::LOAD, 0, bytes.data(), bytes.size());
+    if (!answer()) return EXIT_FAILURE;
+    if (!sent) {
+        std::cerr << "Error: Lost the server\n";
+        return EXIT_FAILURE;
+    }
+    if (header.type != MessageType::LOADED) {
+        std::cerr << "Error: Unexpected answer from the server\n";
+        return EXIT_FAILURE;
+    }
+    const double loading = seconds_since(start);
+
+    Job job = {};
+    job.scene = header.tile;
+    job.camera = scene.camera;
+    job.height = scene.settings.height;
+    job.ratio = scene.settings.ratio;
+    job.pixel_spacing = scene.settings.pixel_spacing;
+    job.SSAA = scene.settings.SSAA_factor;
+    job.region = region;
+
+    const auto rendering = std::chrono::steady_clock::now();
+    if (!connection->send(MessageType::RENDER, 1, &job, sizeof(job))) {
+        std::cerr << "Error: Lost the server\n";
+        return EXIT_FAILURE;
+    }
+    if (!answer()) return EXIT_FAILURE;
+
+    Tile rendered = { 0, 0, 0, 0 };
+    if (header.type == MessageType::IMAGE && payload.size() >= sizeof(rendered)) std::memcpy(&rendered, payload.data(), sizeof(rendered));
+    const std::size_t pixel_count = rendered.x1 > rendered.x0 && rendered.y1 > rendered.y0
+                                  ? static_cast<std::size_t>(rendered.x1 - rendered.x0) * (rendered.y1 - rendered.y0) : 0;
+    if (pixel_count == 0 || payload.size() != sizeof(rendered) + pixel_count * sizeof(Color)) {
+        std::cerr << "Error: Unexpected answer from the server\n";
+        return EXIT_FAILURE;
+    }
+    T_COLOR colors(rendered.x1 - rendered.x0, rendered.y1 - rendered.y0);
+    std::memcpy(colors.data(), payload.data() + sizeof(rendered), colors.size() * sizeof(Color));
+    std::cout << "Client: scene " << job.scene << " loaded in " << loading << " s, rendered " << colors.width() << "x" << colors.height()
+              << " in " << seconds_since(rendering) << " s\n";
+
+    if (!image::write(colors, output_path)) return EXIT_FAILURE;
+    std::cout << "Wrote " << output_path << "\n";
+    return EXIT_SUCCESS;
+}
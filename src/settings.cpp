@@ -0,0 +1,126 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "camera.hpp"
+#include "settings.hpp"
+
+namespace {
+    bool parse_float(const std::string& value, float& out) {
+        char* end;
+        out = std::strtof(value.c_str(), &end);
+        return !value.empty() && *end == '\0';
+    }
+
+    bool parse_int(const std::string& value, int& out) {
+        char* end;
+        long parsed = std::strtol(value.c_str(), &end, 10);
+        out = static_cast<int>(parsed);
+        return !value.empty() && *end == '\0';
+    }
+
+    bool parse_bool(const std::string& value, bool& out) {
+        if (value == "1" || value == "true" || value == "on")       out = true;
+        else if (value == "0" || value == "false" || value == "off") out = false;
+        else return false;
+        return true;
+    }
+
+    // "16:9" or "1.777"
+    bool parse_ratio(const std::string& value, float& out) {
+        std::size_t colon = value.find(':');
+        if (colon == std::string::npos) return parse_float(value, out);
+
+        float w, h;
+        if (!parse_float(value.substr(0, colon), w) || !parse_float(value.substr(colon + 1), h) || h == 0) return false;
+        out = w / h;
+        return true;
+    }
+}
+
+[[nodiscard]] bool apply_setting(const std::string& key, const std::string& value, RenderSettings& settings, _Camera& camera) {
+    bool valid = true;
+    int i;
+    float f;
+
+    ////// OUTPUT //////
+    if (key == "output")                    settings.output_path = value;
+    else if (key == "headless")             valid = parse_bool(value, settings.headless);
+    else if (key == "overwrite") {
+        if (value == "refuse")              settings.overwrite = OverwritePolicy::REFUSE;
+        else if (value == "overwrite")      settings.overwrite = OverwritePolicy::OVERWRITE;
+        else if (value == "unique")         settings.overwrite = OverwritePolicy::UNIQUE;
+        else valid = false;
+    }
+    else if (key == "band_height")          valid = parse_int(value, settings.band_height) && settings.band_height >= 0;
+    else if (key == "stats")                valid = parse_bool(value, settings.print_stats);
+    else if (key == "stats_json")           settings.stats_path = value;
+    else if (key == "heatmap")              settings.heatmap_path = value;
+
+    ////// IMAGE //////
+    else if (key == "height")               valid = parse_int(value, settings.height) && settings.height > 0;
+    else if (key == "ratio")                valid = parse_ratio(value, settings.ratio) && settings.ratio > 0;
+    else if (key == "pixel_spacing")        valid = parse_float(value, settings.pixel_spacing) && settings.pixel_spacing > 0;
+    else if (key == "ssaa")                 valid = parse_int(value, settings.SSAA_factor) && settings.SSAA_factor > 0;
+    else if (key == "ssaa_jitter")          valid = parse_bool(value, settings.SSAA_jitter);
+    else if (key == "adaptive")             valid = parse_bool(value, settings.adaptive_sampling);
+    else if (key == "adaptive_min")         valid = parse_int(value, settings.adaptive_min_samples) && settings.adaptive_min_samples > 0;
+    else if (key == "adaptive_max")         valid = parse_int(value, settings.adaptive_max_samples) && settings.adaptive_max_samples > 0;
+    else if (key == "adaptive_threshold")   valid = parse_float(value, settings.adaptive_threshold);
+    else if (key == "seed")                 { valid = parse_int(value, i); settings.seed = static_cast<std::uint32_t>(i); }
+    else if (key == "light_samples")        valid = parse_int(value, settings.light_samples) && settings.light_samples >= 0;
+    else if (key == "path_cutoff")          valid = parse_float(value, settings.path_cutoff) && settings.path_cutoff >= 0;
+    else if (key == "roulette")             valid = parse_float(value, settings.roulette) && settings.roulette >= 0 && settings.roulette <= 1;
+    else if (key == "denoise")              valid = parse_bool(value, settings.denoise);
+    else if (key == "denoise_passes")       valid = parse_int(value, settings.denoise_passes) && settings.denoise_passes >= 0 && settings.denoise_passes <= 12;
+    else if (key == "denoise_strength")     valid = parse_float(value, settings.denoise_strength) && settings.denoise_strength > 0;
+    else if (key == "sampler") {
+        if (value == "random")              settings.sampler_mode = SamplerMode::RANDOM;
+        else if (value == "low_discrepancy") settings.sampler_mode = SamplerMode::LOW_DISCREPANCY;
+        else valid = false;
+    }
+
+    ////// PERFORMANCE //////
+    else if (key == "threads")              valid = parse_int(value, settings.thread_count) && settings.thread_count >= 0;
+    else if (key == "tile_size")            valid = parse_int(value, settings.tile_size) && settings.tile_size > 0;
+    else if (key == "framebuffer") {
+        if (value == "tiled")               settings.framebuffer_layout = FramebufferLayout::TILED;
+        else if (value == "row_major")      settings.framebuffer_layout = FramebufferLayout::ROW_MAJOR;
+        else valid = false;
+    }
+    else if (key == "bvh")                  valid = parse_bool(value, settings.use_bvh);
+    else if (key == "incremental")          valid = parse_bool(value, settings.incremental);
+    else if (key == "encode_queue")         valid = parse_int(value, settings.encode_queue) && settings.encode_queue >= 0;
+    else if (key == "gbuffer")              valid = parse_bool(value, settings.gbuffer);
+    else if (key == "specialize")           valid = parse_bool(value, settings.specialize);
+    else if (key == "engine") {
+        if (value == "recursive")           settings.engine = RenderEngine::RECURSIVE;
+        else if (value == "wavefront")      settings.engine = RenderEngine::WAVEFRONT;
+        else valid = false;
+    }
+
+    ////// INTERACTIVE //////
+    else if (key == "target_fps")           valid = parse_float(value, settings.target_fps) && settings.target_fps > 0;
+    else if (key == "move_speed")           valid = parse_float(value, settings.move_speed) && settings.move_speed > 0;
+
+    ////// DISTRIBUTED //////
+    else if (key == "remote_tile_size")     valid = parse_int(value, settings.remote_tile_size) && settings.remote_tile_size > 0;
+    else if (key == "worker_timeout")       valid = parse_float(value, settings.worker_timeout) && settings.worker_timeout > 0;
+
+    ////// SERVER //////
+    else if (key == "server_memory")        valid = parse_int(value, settings.server_memory) && settings.server_memory > 0;
+
+    ////// CAMERA //////
+    else if (key == "focal_length")         valid = parse_float(value, camera.focal_length);
+    else if (key == "fov")                  { valid = parse_float(value, f); camera.fov = f * PI / 180; }   // Degrees
+    else if (key == "render_distance")      valid = parse_float(value, camera.render_distance);
+    else if (key == "scene_lighting")       valid = parse_float(value, camera.scene_lighting);
+    else if (key == "max_reflection_depth") { valid = parse_int(value, i) && i >= 0; camera.max_reflection_depth = i; }
+
+    else {
+        std::cerr << "Error: Unknown setting {" << key << "}\n";
+        return false;
+    }
+
+    if (!valid) std::cerr << "Error: Bad value {" << value << "} for setting {" << key << "}\n";
+    return valid;
+}
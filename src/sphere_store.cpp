@@ -0,0 +1,205 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <span>
+#include <string>
+#include <vector>
+#include "sphere_store.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define RAYTRACER_X86
+    #include <immintrin.h>
+#endif
+
+// Every kernel does exactly what Sphere::intersect does, in the same order of operations,
+// so they all give bit identical results. Lanes are accepted in slot order with a strict <,
+// just like the scalar loop, which makes ties resolve the same way too.
+namespace {
+    int intersect_scalar(const SphereStore::View& v, const Ray& ray, const int& first, const int& count, float& t_max) {
+        int best = -1;
+        for (int i = first; i < first + count; i++) {
+            float vx = v.x[i] - ray.position.x, vy = v.y[i] - ray.position.y, vz = v.z[i] - ray.position.z;
+            float projection = vx * ray.direction.x + vy * ray.direction.y + vz * ray.direction.z;
+            float discriminant = (vx * vx + vy * vy + vz * vz) - projection * projection;
+            if (discriminant > v.radius2[i]) continue;
+
+            float t = projection - std::sqrt(v.radius2[i] - discriminant);
+            if (t < 0) continue;
+            if (t < t_max) {
+                t_max = t;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+#ifdef RAYTRACER_X86
+    // Picks the closest lane of a hit mask, in lane order
+    inline void resolve_lanes(unsigned bits, const float* t_lanes, const int& base, float& t_max, int& best) {
+        while (bits) {
+            int lane = __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (t_lanes[lane] < t_max) {
+                t_max = t_lanes[lane];
+                best = base + lane;
+            }
+        }
+    }
+
+    __attribute__((target("sse2")))
+    int intersect_sse(const SphereStore::View& v, const Ray& ray, const int& first, const int& count, float& t_max) {
+        const __m128 ox = _mm_set1_ps(ray.position.x), oy = _mm_set1_ps(ray.position.y), oz = _mm_set1_ps(ray.position.z);
+        const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+        alignas(16) float t_lanes[4];
+        int best = -1;
+
+        for (int base = first; base < first + count; base += 4) {
+            __m128 vx = _mm_sub_ps(_mm_loadu_ps(v.x + base), ox);
+            __m128 vy = _mm_sub_ps(_mm_loadu_ps(v.y + base), oy);
+            __m128 vz = _mm_sub_ps(_mm_loadu_ps(v.z + base), oz);
+            __m128 r2 = _mm_loadu_ps(v.radius2 + base);
+
+            __m128 projection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+            __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+            __m128 discriminant = _mm_sub_ps(length2, _mm_mul_ps(projection, projection));
+            __m128 t = _mm_sub_ps(projection, _mm_sqrt_ps(_mm_sub_ps(r2, discriminant)));
+
+            __m128 hit = _mm_andnot_ps(_mm_cmpgt_ps(discriminant, r2),
+                         _mm_andnot_ps(_mm_cmplt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(t_max))));
+            hit = _mm_and_ps(hit, _mm_castsi128_ps(_mm_cmplt_epi32(lanes, _mm_set1_epi32(first + count - base))));
+
+            unsigned bits = _mm_movemask_ps(hit);
+            if (!bits) continue;
+            _mm_store_ps(t_lanes, t);
+            resolve_lanes(bits, t_lanes, base, t_max, best);
+        }
+        return best;
+    }
+
+    __attribute__((target("avx2")))
+    int intersect_avx2(const SphereStore::View& v, const Ray& ray, const int& first, const int& count, float& t_max) {
+        const __m256 ox = _mm256_set1_ps(ray.position.x), oy = _mm256_set1_ps(ray.position.y), oz = _mm256_set1_ps(ray.position.z);
+        const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        alignas(32) float t_lanes[8];
+        int best = -1;
+
+        for (int base = first; base < first + count; base += 8) {
+            __m256 vx = _mm256_sub_ps(_mm256_loadu_ps(v.x + base), ox);
+            __m256 vy = _mm256_sub_ps(_mm256_loadu_ps(v.y + base), oy);
+            __m256 vz = _mm256_sub_ps(_mm256_loadu_ps(v.z + base), oz);
+            __m256 r2 = _mm256_loadu_ps(v.radius2 + base);
+
+            __m256 projection = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, dx), _mm256_mul_ps(vy, dy)), _mm256_mul_ps(vz, dz));
+            __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+            __m256 discriminant = _mm256_sub_ps(length2, _mm256_mul_ps(projection, projection));
+            __m256 t = _mm256_sub_ps(projection, _mm256_sqrt_ps(_mm256_sub_ps(r2, discriminant)));
+
+            __m256 hit = _mm256_andnot_ps(_mm256_cmp_ps(discriminant, r2, _CMP_GT_OQ),
+                         _mm256_andnot_ps(_mm256_cmp_ps(t, zero, _CMP_LT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+            hit = _mm256_and_ps(hit, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(first + count - base), lanes)));
+
+            unsigned bits = _mm256_movemask_ps(hit);
+            if (!bits) continue;
+            _mm256_store_ps(t_lanes, t);
+            resolve_lanes(bits, t_lanes, base, t_max, best);
+        }
+        return best;
+    }
+
+    __attribute__((target("avx512f")))
+    int intersect_avx512(const SphereStore::View& v, const Ray& ray, const int& first, const int& count, float& t_max) {
+        const __m512 ox = _mm512_set1_ps(ray.position.x), oy = _mm512_set1_ps(ray.position.y), oz = _mm512_set1_ps(ray.position.z);
+        const __m512 dx = _mm512_set1_ps(ray.direction.x), dy = _mm512_set1_ps(ray.direction.y), dz = _mm512_set1_ps(ray.direction.z);
+        const __m512 zero = _mm512_setzero_ps();
+        alignas(64) float t_lanes[16];
+        int best = -1;
+
+        for (int base = first; base < first + count; base += 16) {
+            int remaining = first + count - base;
+            __mmask16 lanes = remaining >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << remaining) - 1);
+
+            __m512 vx = _mm512_sub_ps(_mm512_loadu_ps(v.x + base), ox);
+            __m512 vy = _mm512_sub_ps(_mm512_loadu_ps(v.y + base), oy);
+            __m512 vz = _mm512_sub_ps(_mm512_loadu_ps(v.z + base), oz);
+            __m512 r2 = _mm512_loadu_ps(v.radius2 + base);
+
+            __m512 projection = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, dx), _mm512_mul_ps(vy, dy)), _mm512_mul_ps(vz, dz));
+            __m512 length2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy)), _mm512_mul_ps(vz, vz));
+            __m512 discriminant = _mm512_sub_ps(length2, _mm512_mul_ps(projection, projection));
+            __m512 t = _mm512_sub_ps(projection, _mm512_sqrt_ps(_mm512_sub_ps(r2, discriminant)));
+
+            __mmask16 hit = lanes
+                          & ~_mm512_cmp_ps_mask(discriminant, r2, _CMP_GT_OQ)
+                          & ~_mm512_cmp_ps_mask(t, zero, _CMP_LT_OQ)
+                          & _mm512_cmp_ps_mask(t, _mm512_set1_ps(t_max), _CMP_LT_OQ);
+            if (!hit) continue;
+            _mm512_store_ps(t_lanes, t);
+            resolve_lanes(hit, t_lanes, base, t_max, best);
+        }
+        return best;
+    }
+#endif
+
+    float* aligned_array(const std::size_t& size) {
+        std::size_t bytes = ((size * sizeof(float) + 63) / 64) * 64;
+        float* p = static_cast<float*>(std::aligned_alloc(64, bytes));
+        std::memset(p, 0, bytes);
+        return p;
+    }
+}
+
+void SphereStore::build(std::span<const Sphere> spheres, const std::vector<int>& order) {
+    _size = spheres.size();
+    _ids.resize(_size);
+    if (order.empty()) std::iota(_ids.begin(), _ids.end(), 0);
+    else _ids = order;
+
+    // One extra vector of padding, so a full load from the last slot stays in bounds
+    const std::size_t capacity = _size + PADDING;
+    _x.reset(aligned_array(capacity));
+    _y.reset(aligned_array(capacity));
+    _z.reset(aligned_array(capacity));
+    _radius2.reset(aligned_array(capacity));
+
+    for (std::size_t i = 0; i < _size; i++) {
+        const Sphere& sphere = spheres[_ids[i]];
+        _x[i] = sphere.center.x;
+        _y[i] = sphere.center.y;
+        _z[i] = sphere.center.z;
+        _radius2[i] = sphere.radius * sphere.radius;
+    }
+
+    _view = { _x.get(), _y.get(), _z.get(), _radius2.get() };
+}
+
+// Picks the widest kernel the cpu supports.
+// RAYTRACER_SIMD=scalar|sse|avx2|avx512 forces one, handy for comparing them
+void SphereStore::select_kernel() {
+    const char* forced = std::getenv("RAYTRACER_SIMD");
+    const std::string wanted = forced ? forced : "";
+
+    _kernel = intersect_scalar; _lane_count = 1; _kernel_name = "scalar";
+    if (wanted == "scalar") return;
+
+#ifdef RAYTRACER_X86
+    __builtin_cpu_init();
+    const bool any = wanted.empty();
+
+    if ((any || wanted == "avx512") && __builtin_cpu_supports("avx512f")) {
+        _kernel = intersect_avx512; _lane_count = 16; _kernel_name = "avx512";
+    } else if ((any || wanted == "avx2") && __builtin_cpu_supports("avx2")) {
+        _kernel = intersect_avx2; _lane_count = 8; _kernel_name = "avx2";
+    } else if ((any || wanted == "sse") && __builtin_cpu_supports("sse2")) {
+        _kernel = intersect_sse; _lane_count = 4; _kernel_name = "sse";
+    }
+#endif
+
+    if (!wanted.empty() && wanted != _kernel_name)
+        std::cerr << "Warning: RAYTRACER_SIMD=" << wanted << " is not supported, using " << _kernel_name << "\n";
+}
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include "stats.hpp"
+
+namespace {
+    const char* STAGE_NAMES[] = { "scene_setup", "tracing", "shading", "denoise", "resolve", "encode", "display" };
+    static_assert(std::size(STAGE_NAMES) == static_cast<std::size_t>(stats::Stage::COUNT));
+
+    // Deepest bin that got any rays, so the histogram doesnt print a tail of zeros
+    int used_depth_bins(const stats::Counters& counters) {
+        int bins = stats::DEPTH_BINS;
+        while (bins > 1 && counters.depth_histogram[bins - 1] == 0) bins--;
+        return bins;
+    }
+
+    struct HeatmapSummary {
+        std::uint32_t max = 0;
+        double mean = 0;
+    };
+
+    HeatmapSummary summarize(const Framebuffer<std::uint32_t>& heatmap) {
+        HeatmapSummary summary;
+        if (heatmap.size() == 0) return summary;
+
+        double sum = 0;
+        for (std::size_t i = 0; i < heatmap.size(); i++) {
+            summary.max = std::max(summary.max, heatmap.data()[i]);
+            sum += heatmap.data()[i];
+        }
+        summary.mean = sum / heatmap.size();
+        return summary;
+    }
+}
+
+void stats::Counters::add(const Counters& other) {
+    primary_rays += other.primary_rays;
+    reflection_rays += other.reflection_rays;
+    stopped_paths += other.stopped_paths;
+    shadow_rays += other.shadow_rays;
+    sphere_tests += other.sphere_tests;
+    triangle_tests += other.triangle_tests;
+    bvh_nodes += other.bvh_nodes;
+    for (int i = 0; i < DEPTH_BINS; i++) depth_histogram[i] += other.depth_histogram[i];
+    tracing_seconds += other.tracing_seconds;
+    shading_seconds += other.shading_seconds;
+}
+
+RenderStats::RenderStats(const int& thread_count) : _threads(thread_count) {}
+
+void RenderStats::start_heatmap(const int& width, const int& height, const int& origin_x, const int& origin_y) {
+    _heatmap = Framebuffer<std::uint32_t>(width, height, FramebufferLayout::ROW_MAJOR, 32, origin_x, origin_y);
+    std::fill(_heatmap.data(), _heatmap.data() + _heatmap.size(), 0);
+}
+
+[[nodiscard]] stats::Counters RenderStats::total() const {
+    stats::Counters total;
+    for (auto& counters : _threads) total.add(counters);
+    return total;
+}
+
+[[nodiscard]] RenderStats::StageSeconds RenderStats::stage_seconds(const stats::Counters& counters) const {
+    StageSeconds seconds = _seconds;
+    const double busy = counters.tracing_seconds + counters.shading_seconds;
+    if (counters.shading_seconds > 0 && busy > 0) {
+        const double shading = seconds[static_cast<int>(stats::Stage::TRACING)] * counters.shading_seconds / busy;
+        seconds[static_cast<int>(stats::Stage::SHADING)] += shading;
+        seconds[static_cast<int>(stats::Stage::TRACING)] -= shading;
+    }
+    return seconds;
+}
+
+void RenderStats::print_summary(std::ostream& out) const {
+    const stats::Counters counters = total();
+    const StageSeconds seconds = stage_seconds(counters);
+    const std::uint64_t rays = counters.primary_rays + counters.reflection_rays + counters.shadow_rays;
+    const double per_ray = rays ? 1.0 / rays : 0;
+
+    out << "Render stats (" << _threads.size() << " threads)\n" << std::fixed;
+    for (int i = 0; i < static_cast<int>(stats::Stage::COUNT); i++) {
+        if (seconds[i] == 0) continue;
+        out << "  " << std::left << std::setw(18) << STAGE_NAMES[i] << std::right << std::setprecision(3) << std::setw(10) << seconds[i] << " s\n";
+    }
+
+    const double tracing = seconds[static_cast<int>(stats::Stage::TRACING)] + seconds[static_cast<int>(stats::Stage::SHADING)];
+    out << "  " << std::left << std::setw(18) << "primary rays"    << std::right << std::setw(14) << counters.primary_rays << "\n"
+        << "  " << std::left << std::setw(18) << "reflection rays" << std::right << std::setw(14) << counters.reflection_rays << "\n"
+        << "  " << std::left << std::setw(18) << "stopped paths"   << std::right << std::setw(14) << counters.stopped_paths << "\n"
+        << "  " << std::left << std::setw(18) << "shadow rays"     << std::right << std::setw(14) << counters.shadow_rays << "\n"
+        << "  " << std::left << std::setw(18) << "sphere tests"    << std::right << std::setw(14) << counters.sphere_tests
+        << std::setprecision(1) << "  (" << counters.sphere_tests * per_ray << " per ray)\n"
+        << "  " << std::left << std::setw(18) << "triangle tests"  << std::right << std::setw(14) << counters.triangle_tests
+        << "  (" << counters.triangle_tests * per_ray << " per ray)\n"
+        << "  " << std::left << std::setw(18) << "bvh nodes"       << std::right << std::setw(14) << counters.bvh_nodes
+        << "  (" << counters.bvh_nodes * per_ray << " per ray)\n";
+    if (tracing > 0)
+        out << "  " << std::left << std::setw(18) << "rays per second" << std::right << std::setprecision(0) << std::setw(14) << rays / tracing << "\n";
+
+    out << "  " << std::left << std::setw(18) << "rays per depth" << std::right;
+    for (int i = 0; i < used_depth_bins(counters); i++) out << " " << i << ":" << counters.depth_histogram[i];
+    out << "\n";
+
+    const HeatmapSummary heatmap = summarize(_heatmap);
+    if (heatmap.max > 0)
+        out << "  " << std::left << std::setw(18) << "cost per pixel" << std::right << std::setprecision(1)
+            << "mean " << heatmap.mean << ", max " << heatmap.max << "\n";
+}
+
+[[nodiscard]] bool RenderStats::write_json(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Error: Couldnt write {" << path << "}\n";
+        return false;
+    }
+
+    const stats::Counters counters = total();
+    const StageSeconds seconds = stage_seconds(counters);
+    const HeatmapSummary heatmap = summarize(_heatmap);
+
+    file << std::fixed << std::setprecision(6) << "{\n  \"threads\": " << _threads.size() << ",\n  \"seconds\": {";
+    for (int i = 0; i < static_cast<int>(stats::Stage::COUNT); i++)
+        file << (i ? ", " : "") << "\"" << STAGE_NAMES[i] << "\": " << seconds[i];
+    file << "},\n"
+         << "  \"primary_rays\": " << counters.primary_rays << ",\n"
+         << "  \"reflection_rays\": " << counters.reflection_rays << ",\n"
+         << "  \"stopped_paths\": " << counters.stopped_paths << ",\n"
+         << "  \"shadow_rays\": " << counters.shadow_rays << ",\n"
+         << "  \"sphere_tests\": " << counters.sphere_tests << ",\n"
+         << "  \"triangle_tests\": " << counters.triangle_tests << ",\n"
+         << "  \"bvh_nodes\": " << counters.bvh_nodes << ",\n"
+         << "  \"depth_histogram\": [";
+    for (int i = 0; i < used_depth_bins(counters); i++) file << (i ? ", " : "") << counters.depth_histogram[i];
+    file << "],\n  \"heatmap\": {\"width\": " << _heatmap.width() << ", \"height\": " << _heatmap.height()
+         << ", \"mean\": " << std::setprecision(3) << heatmap.mean << ", \"max\": " << heatmap.max << "}\n}\n";
+
+    return static_cast<bool>(file);
+}
+
+[[nodiscard]] T_COLOR RenderStats::heatmap_image() const {
+    T_COLOR image(_heatmap.width(), _heatmap.height());
+    const float scale = 1.0f / std::max<std::uint32_t>(1, summarize(_heatmap).max);
+
+    for (int y = 0; y < _heatmap.height(); y++) {
+        for (int x = 0; x < _heatmap.width(); x++) {
+            // Three ramps, one per channel
+            const float v = 3 * scale * _heatmap.at(_heatmap.origin_x() + x, _heatmap.origin_y() + y);
+            auto channel = [&](const float& start) { return static_cast<unsigned char>(255 * std::clamp(v - start, 0.0f, 1.0f)); };
+            image.at(x, y) = { channel(0), channel(1), channel(2), 255 };
+        }
+    }
+
+    return image;
+}
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <raylib.h>
+#include <vector>
+#include "footprint.hpp"
+#include "manager.hpp"
+#include "objects.hpp"
+#include "shading.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "wavefront.hpp"
+
+// One tile of render_scene, the stages are explained in wavefront.hpp
+void RayTracingManager::trace_wavefront(const Tile& tile, wavefront::Buffers& b, T_PIXEL& pixels, const float& tan_half_fov) const {
+    stats::Counters& counters = stats::local();
+
+    // Every stage adds its time to either tracing or shading
+    auto lap_start = std::chrono::steady_clock::now();
+    auto lap = [&](double& seconds) {
+        const auto now = std::chrono::steady_clock::now();
+        seconds += std::chrono::duration<double>(now - lap_start).count();
+        lap_start = now;
+    };
+
+    const int SSAA = static_cast<int>(_SSAA_factor);
+    // Of the whole frame, pixels can be a window of it (render_region)
+    const int displayed_width = static_cast<int>(std::ceil(_upsampled_width)) / SSAA;
+    const int displayed_height = static_cast<int>(std::ceil(_upsampled_height)) / SSAA;
+    const std::size_t light_count = _lights.size();
+
+    if (b.last_occluders.size() != light_count) b.last_occluders.assign(light_count, -1);
+    if (b.waves.empty()) b.waves.resize(1);
+
+    ////// GENERATE //////
+    // Exactly the rays and samplers of render_scene, in tile order
+    wavefront::Wave& primary = b.waves[0];
+    primary.clear();
+    b.samplers.clear();
+    b.corrections.assign(static_cast<std::size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0), {0, 0, 0});
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++) {
+            const Sampler sampler(_settings.seed, (_y / SSAA) * displayed_width + _x / SSAA, (_y % SSAA) * SSAA + _x % SSAA, _settings.sampler_mode);
+            const Vector2 jitter = _settings.SSAA_jitter ? sampler.pixel_offset() : Vector2{0, 0};
+
+            float x =  (2.0f * (_x + jitter.x) / _upsampled_width  - 1) * tan_half_fov * _displayed_ratio;
+            float y = -(2.0f * (_y + jitter.y) / _upsampled_height - 1) * tan_half_fov;
+
+            primary.rays.push_back({
+                .position = _camera->position,
+                .direction = utils::normalize({x, y, -1 / _camera->focal_length})
+            });
+            primary.paths.push_back(static_cast<int>(b.samplers.size()));
+            primary.routes.emplace_back(b.corrections[b.samplers.size()]);
+            b.samplers.push_back(sampler);
+        }
+    }
+    counters.primary_rays += primary.rays.size();
+    b.costs.assign(b.samplers.size(), 0);
+
+    int depth = 0;
+    for (; depth < static_cast<int>(b.waves.size()) && !b.waves[depth].rays.empty(); depth++) {
+        if (static_cast<int>(b.waves.size()) < depth + 2) b.waves.resize(depth + 2);
+        wavefront::Wave& wave = b.waves[depth];
+        wavefront::Wave& next = b.waves[depth + 1];
+        next.clear();
+
+        const int ray_count = static_cast<int>(wave.rays.size());
+        counters.depth_histogram[std::min(depth, stats::DEPTH_BINS - 1)] += ray_count;
+
+        ////// INTERSECT //////
+        wave.terms.resize(ray_count);
+        wave.missed.resize(ray_count);
+        wave.bounces.clear();
+        for (int i = 0; i < ray_count; i++) wave.bounces.emplace_back(wave.routes[i]);
+        b.hits.clear();
+        for (int i = 0; i < ray_count; i++) {
+            const std::uint64_t cost = counters.cost();
+
+            wavefront::Hit hit = { i, nullptr, {} };
+            const Ray& ray = wave.rays[i];
+            wave.missed[i] = !scene_intersect(ray, hit.sphere, hit.point);
+            if (depth > 0) footprint::reflection(ray.position, wave.missed[i] ? ray.position + _camera->render_distance * ray.direction : hit.point);
+
+            if (wave.missed[i]) wave.terms[i] = shading::sky(ray);
+            else {
+                b.hits.push_back(hit);
+                footprint::hit();
+            }
+
+            b.costs[wave.paths[i]] += counters.cost() - cost;
+        }
+        lap(counters.tracing_seconds);
+
+        ////// SORT //////
+        // Hits on the same sphere (and so the same material) next to each other
+        std::sort(b.hits.begin(), b.hits.end(), [](const wavefront::Hit& a, const wavefront::Hit& c) {
+            return std::less<const Sphere*>()(a.sphere, c.sphere);
+        });
+
+        const int hit_count = static_cast<int>(b.hits.size());
+        b.normals.resize(hit_count);
+        b.viewing_directions.resize(hit_count);
+        b.diffuse.resize(hit_count);
+        b.specular.resize(hit_count);
+        b.shadow_rays.resize(hit_count * light_count);
+        b.light_distances.resize(hit_count * light_count);
+        b.occluded.resize(hit_count * light_count);
+
+        for (int h = 0; h < hit_count; h++) {
+            const wavefront::Hit& hit = b.hits[h];
+            const _Material& material = hit.sphere->material;
+
+            b.normals[h] = utils::normalize(hit.point - hit.sphere->center);
+            b.viewing_directions[h] = utils::normalize(_camera->position - hit.point);
+            b.diffuse[h]  = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+            b.specular[h] = (material.ambient_reflection - 1) + (_camera->scene_lighting - 1);
+
+            for (std::size_t l = 0; l < light_count; l++) {
+                const Vector3 light_direction = utils::normalize(_lights[l].position - hit.point);
+                b.shadow_rays[h * light_count + l] = shading::shadow_ray(hit.point, b.normals[h], light_direction);
+                b.light_distances[h * light_count + l] = utils::length(_lights[l].position - hit.point);
+            }
+        }
+        counters.shadow_rays += hit_count * light_count;
+        lap(counters.shading_seconds);
+
+        ////// SHADOWS //////
+        // Light by light, so the last occluder of a light gets tried on neighbouring hits
+        for (std::size_t l = 0; l < light_count; l++) {
+            for (int h = 0; h < hit_count; h++) {
+                const std::size_t q = h * light_count + l;
+                const Ray& shadow_ray = b.shadow_rays[q];
+                footprint::shadow(l, shadow_ray.position);
+
+                const std::uint64_t cost = counters.cost();
+                b.occluded[q] = scene_occluded(b.shadow_rays[q], b.light_distances[q], b.last_occluders[l]);
+                b.costs[wave.paths[b.hits[h].ray]] += counters.cost() - cost;
+            }
+        }
+        lap(counters.tracing_seconds);
+
+        ////// SHADE //////
+        for (int h = 0; h < hit_count; h++) {
+            const wavefront::Hit& hit = b.hits[h];
+            const _Material& material = hit.sphere->material;
+
+            for (std::size_t l = 0; l < light_count; l++) {
+                const std::size_t q = h * light_count + l;
+                if (b.occluded[q]) continue;
+                shading::add_light(material, _lights[l], b.shadow_rays[q].direction, b.normals[h], b.viewing_directions[h], b.diffuse[h], b.specular[h]);
+            }
+
+            wave.terms[hit.ray] = (b.diffuse[h] + b.specular[h]) * material.albedo;
+        }
+
+        ////// REFLECT //////
+        for (int h = 0; h < hit_count; h++) {
+            const wavefront::Hit& hit = b.hits[h];
+            const _Material& material = hit.sphere->material;
+            if (material.scattering_constant == 0 || depth >= _camera->max_reflection_depth) continue;
+
+            const int path = wave.paths[hit.ray];
+            shading::Bounce& bounce = wave.bounces[hit.ray];
+            bounce = shading::follow(wave.terms[hit.ray], wave.routes[hit.ray], _settings.path_cutoff, _settings.roulette, b.samplers[path], depth);
+            if (!bounce.follow) {
+                counters.stopped_paths++;
+                continue;
+            }
+
+            next.rays.push_back(shading::reflection(hit.point, b.normals[h], b.viewing_directions[h], material, b.samplers[path], depth));
+            next.paths.push_back(path);
+            next.routes.push_back(bounce.path);
+        }
+        counters.reflection_rays += next.rays.size();
+        lap(counters.shading_seconds);
+    }
+
+    ////// FOLD //////
+    // Deepest wave first: color = clamp(local + color of the reflection)
+    b.colors.assign(b.samplers.size(), {0, 0, 0});
+    for (int d = depth - 1; d >= 0; d--) {
+        const wavefront::Wave& wave = b.waves[d];
+        for (std::size_t i = 0; i < wave.rays.size(); i++) {
+            Vector3& color = b.colors[wave.paths[i]];
+            color = wave.missed[i] ? wave.terms[i] : shading::with_reflection(wave.terms[i], color, wave.bounces[i]);
+        }
+    }
+
+    int path = 0;
+    for (int _y = tile.y0; _y < tile.y1; _y++) {
+        for (int _x = tile.x0; _x < tile.x1; _x++, path++) {
+            pixels.at(_x, _y) = b.colors[path] + b.corrections[path];
+            if (_x < displayed_width * SSAA && _y < displayed_height * SSAA)
+                _stats->add_cost(_x / SSAA, _y / SSAA, b.costs[path]);
+        }
+    }
+    lap(counters.tracing_seconds);
+}